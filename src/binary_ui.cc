@@ -0,0 +1,208 @@
+#include "binary_ui.hh"
+
+#include "debug.hh"
+#include "display_buffer.hh"
+#include "exception.hh"
+#include "file.hh"
+#include "json_ui.hh"
+#include "keys.hh"
+#include "clock.hh"
+
+#include <unistd.h>
+
+namespace Kakoune
+{
+
+BinaryUI::BinaryUI()
+    : m_stdin_watcher{0, FdEvents::Read, EventMode::Urgent,
+                      [this](FDWatcher&, FdEvents, EventMode) {
+        parse_requests();
+      }}, m_dimensions{24, 80}
+{
+    set_signal_handler(SIGINT, SIG_DFL);
+}
+
+BinaryUI::~BinaryUI()
+{
+    try
+    {
+        flush();
+    }
+    catch (runtime_error&) {}
+}
+
+void BinaryUI::draw(const DisplayBuffer& display_buffer,
+                    const Face& default_face, const Face& padding_face)
+{
+    auto delta = m_delta_tracker.update(display_buffer);
+    write_message(MessageType::DrawDelta, delta.first_face_id, delta.new_faces, default_face, padding_face,
+                  delta.line_count, delta.changed_lines);
+}
+
+void BinaryUI::draw_status(const DisplayLine& status_line,
+                           const DisplayLine& mode_line,
+                           const Face& default_face)
+{
+    write_message(MessageType::DrawStatus, status_line, mode_line, default_face);
+}
+
+void BinaryUI::menu_show(ConstArrayView<DisplayLine> items,
+                         DisplayCoord anchor, Face fg, Face bg,
+                         MenuStyle style)
+{
+    write_message(MessageType::MenuShow, items, anchor, fg, bg, style);
+}
+
+void BinaryUI::menu_select(int selected)
+{
+    write_message(MessageType::MenuSelect, selected);
+}
+
+void BinaryUI::menu_hide()
+{
+    write_message(MessageType::MenuHide);
+}
+
+void BinaryUI::info_show(const DisplayLine& title, const DisplayLineList& content,
+                         DisplayCoord anchor, Face face,
+                         InfoStyle style)
+{
+    write_message(MessageType::InfoShow, title, content, anchor, face, style);
+}
+
+void BinaryUI::info_hide()
+{
+    write_message(MessageType::InfoHide);
+}
+
+void BinaryUI::set_cursor(CursorMode mode, DisplayCoord coord)
+{
+    write_message(MessageType::SetCursor, mode, coord);
+}
+
+// messages are buffered until the end of the frame, so that a whole
+// frame is written at once.
+void BinaryUI::refresh(bool force)
+{
+    write_message(MessageType::Refresh, force);
+    flush();
+}
+
+void BinaryUI::set_ui_options(const Options& options)
+{
+    write_message(MessageType::SetOptions, options);
+    flush();
+}
+
+void BinaryUI::set_on_key(OnKeyCallback callback)
+{
+    m_on_key = std::move(callback);
+}
+
+void BinaryUI::set_on_paste(OnPasteCallback callback)
+{
+    m_on_paste = std::move(callback);
+}
+
+void BinaryUI::flush()
+{
+    if (m_send_buffer.empty())
+        return;
+
+    auto clear_buffer = on_scope_end([this] { m_send_buffer.clear(); });
+    write(1, {m_send_buffer.data(), m_send_buffer.data() + m_send_buffer.size()});
+}
+
+void BinaryUI::parse_requests()
+{
+    if (not m_on_key)
+        return;
+
+    try
+    {
+        while (true)
+        {
+            if (m_input_pos == m_input.size())
+            {
+                if (not fd_readable(0))
+                    break;
+
+                constexpr size_t bufsize = 4096;
+                m_input.resize(bufsize);
+                m_input_pos = 0;
+                ssize_t size = ::read(0, m_input.data(), bufsize);
+                if (size == -1 or size == 0)
+                {
+                    m_input.clear();
+                    m_stdin_watcher.close_fd();
+                    break;
+                }
+                m_input.resize(size);
+            }
+
+            const char* pos = m_input.data() + m_input_pos;
+            m_reader.read_available(pos, m_input.data() + m_input.size());
+            m_input_pos = pos - m_input.data();
+            if (not m_reader.ready())
+                continue;
+
+            // reset the reader before running callbacks, as they can throw
+            if (m_reader.type() == MessageType::Key)
+            {
+                auto key = m_reader.read<Key>();
+                m_reader.reset();
+                if (key.modifiers == Key::Modifiers::Resize)
+                    m_dimensions = key.coord();
+                m_on_key(key);
+            }
+            else if (m_reader.type() == MessageType::Paste)
+            {
+                auto content = m_reader.read<String>();
+                m_reader.reset();
+                m_on_paste(content);
+            }
+            else // ignore unknown messages
+                m_reader.reset();
+        }
+    }
+    catch (const disconnected& error)
+    {
+        write(2, format("error while handling requests: '{}'\n", error.what()));
+        m_stdin_watcher.close_fd();
+    }
+}
+
+void profile_ui_protocols(const DisplayBuffer& display_buffer,
+                          const Face& default_face, const Face& padding_face)
+{
+    constexpr int count = 100;
+    ByteCount json_size = 0;
+
+    auto json_start = Clock::now();
+    for (int i = 0; i < count; ++i)
+        json_size = json_draw_request(display_buffer, default_face, padding_face).length();
+    auto json_time = Clock::now() - json_start;
+
+    RemoteBuffer buffer;
+    auto binary_start = Clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        DrawDeltaTracker tracker;
+        auto delta = tracker.update(display_buffer);
+        buffer.clear();
+        MsgWriter msg{buffer, MessageType::DrawDelta};
+        msg.write(delta.first_face_id, delta.new_faces, default_face, padding_face,
+                  delta.line_count, delta.changed_lines);
+    }
+    auto binary_time = Clock::now() - binary_start;
+    const size_t binary_size = buffer.size();
+
+    using namespace std::chrono;
+    write_to_debug_buffer(format("Encoding a {} lines frame, {} times:", display_buffer.lines().size(), count));
+    write_to_debug_buffer(format("  json: {} ns per frame, {} bytes per frame",
+                                 duration_cast<nanoseconds>(json_time).count() / count, json_size));
+    write_to_debug_buffer(format("  binary: {} ns per frame, {} bytes per frame",
+                                 duration_cast<nanoseconds>(binary_time).count() / count, binary_size));
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef binary_ui_hh_INCLUDED
+#define binary_ui_hh_INCLUDED
+
+#include "user_interface.hh"
+#include "event_manager.hh"
+#include "coord.hh"
+#include "remote_protocol.hh"
+
+namespace Kakoune
+{
+
+// User interface speaking the remote client protocol on stdin/stdout,
+// see doc/binary_ui.asciidoc
+class BinaryUI : public UserInterface
+{
+public:
+    BinaryUI();
+    ~BinaryUI() override;
+
+    BinaryUI(const BinaryUI&) = delete;
+    BinaryUI& operator=(const BinaryUI&) = delete;
+
+    bool is_ok() const override { return m_stdin_watcher.fd() != -1; }
+
+    void draw(const DisplayBuffer& display_buffer,
+              const Face& default_face,
+              const Face& buffer_padding) override;
+
+    void draw_status(const DisplayLine& status_line,
+                     const DisplayLine& mode_line,
+                     const Face& default_face) override;
+
+    void menu_show(ConstArrayView<DisplayLine> items,
+                   DisplayCoord anchor, Face fg, Face bg,
+                   MenuStyle style) override;
+    void menu_select(int selected) override;
+    void menu_hide() override;
+
+    void info_show(const DisplayLine& title, const DisplayLineList& content,
+                   DisplayCoord anchor, Face face,
+                   InfoStyle style) override;
+    void info_hide() override;
+
+    void set_cursor(CursorMode mode, DisplayCoord coord) override;
+
+    void refresh(bool force) override;
+
+    DisplayCoord dimensions() override { return m_dimensions; }
+    void set_on_key(OnKeyCallback callback) override;
+    void set_on_paste(OnPasteCallback callback) override;
+    void set_ui_options(const Options& options) override;
+
+private:
+    void parse_requests();
+    void flush();
+
+    template<typename ...Args>
+    void write_message(MessageType type, Args&&... args)
+    {
+        MsgWriter msg{m_send_buffer, type};
+        msg.write(std::forward<Args>(args)...);
+    }
+
+    FDWatcher m_stdin_watcher;
+    OnKeyCallback m_on_key;
+    OnPasteCallback m_on_paste;
+    DisplayCoord m_dimensions;
+    MsgReader m_reader;
+    RemoteBuffer m_input;    // data read from stdin
+    size_t m_input_pos = 0;  // start of the data not yet given to m_reader
+    RemoteBuffer m_send_buffer;
+    DrawDeltaTracker m_delta_tracker;
+};
+
+// write to the debug buffer the time and size needed to encode the
+// given display buffer with the json and binary user interfaces.
+void profile_ui_protocols(const DisplayBuffer& display_buffer,
+                          const Face& default_face, const Face& padding_face);
+
+}
+
+#endif // binary_ui_hh_INCLUDED
@@ -27,7 +27,7 @@ Buffer::HistoryNode::HistoryNode(HistoryId parent)
 Buffer::Buffer(String name, Flags flags, BufferLines lines,
                ByteOrderMark bom, EolFormat eolformat,
                FsStatus fs_status)
-    : Scope{GlobalScope::instance()},
+    : Scope{GlobalScope::instance(), "buffer"},
       m_name{(flags & Flags::File) ? real_path(parse_filename(name)) : std::move(name)},
       m_display_name{(flags & Flags::File) ? compact_path(m_name) : m_name},
       m_flags{flags | Flags::NoUndo},
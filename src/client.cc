@@ -34,7 +34,8 @@ Client::Client(std::unique_ptr<UserInterface>&& ui,
       m_on_exit{std::move(on_exit)},
       m_env_vars(std::move(env_vars)),
       m_input_handler{std::move(selections), Context::Flags::None,
-                      std::move(name)}
+                      std::move(name)},
+      m_frame_timer{TimePoint::max(), [](Timer&) {}}
 {
     m_window->set_client(this);
 
@@ -245,6 +246,32 @@ void Client::redraw_ifn()
     if (m_ui_pending == 0)
         return;
 
+    // Skip frames that would be immediately superseded, either because
+    // more input is waiting to be processed, or because max_fps would be
+    // exceeded, full refreshes are never delayed.
+    const auto now = Clock::now();
+    if (not (m_ui_pending & Refresh))
+    {
+        constexpr auto max_input_delay = std::chrono::milliseconds{100};
+        const int max_fps = context().options()["max_fps"].get<int>();
+        const auto next_frame = m_last_frame + (max_fps > 0 ? std::chrono::microseconds{1'000'000 / max_fps}
+                                                            : std::chrono::microseconds{0});
+        if (now < next_frame)
+        {
+            m_frame_timer.set_next_date(next_frame);
+            ++m_frames_dropped;
+            return;
+        }
+        if (has_pending_inputs() and now < m_last_frame + max_input_delay)
+        {
+            ++m_frames_dropped;
+            return;
+        }
+    }
+    m_frame_timer.disable();
+    m_last_frame = now;
+    ++m_frames_produced;
+
     const auto& faces = context().faces();
 
     if (m_ui_pending & Draw)
@@ -4,6 +4,7 @@
 #include "array.hh"
 #include "display_buffer.hh"
 #include "env_vars.hh"
+#include "event_manager.hh"
 #include "input_handler.hh"
 #include "safe_ptr.hh"
 #include "utils.hh"
@@ -62,6 +63,9 @@ public:
     void force_redraw(bool full = false);
     void redraw_ifn();
 
+    size_t frames_produced() const { return m_frames_produced; }
+    size_t frames_dropped() const { return m_frames_dropped; }
+
     void check_if_buffer_needs_reloading();
 
     Context& context() { return m_input_handler.context(); }
@@ -144,6 +148,12 @@ private:
 
     Vector<Key, MemoryDomain::Client> m_pending_keys;
 
+    // wakes up the event loop when a frame delayed by max_fps is due
+    Timer m_frame_timer;
+    TimePoint m_last_frame = {};
+    size_t m_frames_produced = 0;
+    size_t m_frames_dropped = 0;
+
     bool m_buffer_reload_dialog_opened = false;
 };
 
@@ -330,7 +330,7 @@ Token parse_percent_token(ParseState& state, bool throw_on_unterminated)
 
 template<typename Target>
     requires (std::is_same_v<Target, Vector<String>> or std::is_same_v<Target, String>)
-void expand_token(Token&& token, const Context& context, const ShellContext& shell_context, Target& target)
+void expand_token(const Token& token, const Context& context, const ShellContext& shell_context, Target& target)
 {
     constexpr bool single = std::is_same_v<Target, String>;
     auto set_target = [&](auto&& s) {
@@ -537,18 +537,55 @@ void CommandManager::execute_single_command(CommandParameters params,
                            context, shell_context);
 }
 
+RefPtr<CommandManager::ParsedCommandLine> CommandManager::parse_command_line(StringView command_line)
+{
+    if (auto it = m_parsed_command_lines.find(command_line); it != m_parsed_command_lines.end())
+        return it->value;
+
+    RefPtr<ParsedCommandLine> parsed{new ParsedCommandLine{}};
+    parsed->command_line = command_line.str();
+    CommandParser parser(parsed->command_line);
+    try
+    {
+        while (auto token = parser.read_token(true))
+            parsed->tokens.push_back(*std::move(token));
+    }
+    catch (parse_error& error)
+    {
+        parsed->parse_error = error.what().str();
+    }
+
+    // big command lines, such as sourced files, are seldom run again
+    constexpr ByteCount max_cached_length = 16 * 1024;
+    constexpr size_t max_cached_count = 1024;
+    if (command_line.length() <= max_cached_length)
+    {
+        if (m_parsed_command_lines.size() >= max_cached_count)
+            m_parsed_command_lines.clear();
+        m_parsed_command_lines.insert({command_line.str(), parsed});
+    }
+    return parsed;
+}
+
 void CommandManager::execute(StringView command_line,
                              Context& context, const ShellContext& shell_context)
 {
-    CommandParser parser(command_line);
+    // keep a reference, as commands can run other command lines, replacing cache entries
+    const auto parsed = parse_command_line(command_line);
+    const auto& tokens = parsed->tokens;
 
     ByteCount command_pos{};
     Vector<String> params;
-    while (true)
+    // expansions of a single command share the values of the kak_ variables
+    Optional<ShellManager::EnvVarSnapshot> env_var_snapshot;
+    for (auto it = tokens.begin(); ; ++it)
     {
-        Optional<Token> token = parser.read_token(true);
-        if (not token or token->type == Token::Type::CommandSeparator)
+        if (it == tokens.end() and parsed->parse_error)
+            throw runtime_error{*parsed->parse_error};
+
+        if (it == tokens.end() or it->type == Token::Type::CommandSeparator)
         {
+            env_var_snapshot.reset();
             try
             {
                 execute_single_command(params, context, shell_context);
@@ -565,7 +602,7 @@ void CommandManager::execute(StringView command_line,
                 throw;
             }
 
-            if (not token)
+            if (it == tokens.end())
                 return;
 
             params.clear();
@@ -573,13 +610,17 @@ void CommandManager::execute(StringView command_line,
         }
 
         if (params.empty())
-            command_pos = token->pos;
+        {
+            command_pos = it->pos;
+            if (not env_var_snapshot)
+                env_var_snapshot.emplace();
+        }
 
-        if (token->type == Token::Type::ArgExpand and token->content == '@')
+        if (it->type == Token::Type::ArgExpand and it->content == '@')
             params.insert(params.end(), shell_context.params.begin(),
                           shell_context.params.end());
         else
-            expand_token(*std::move(token), context, shell_context, params);
+            expand_token(*it, context, shell_context, params);
     }
 }
 
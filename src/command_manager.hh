@@ -9,6 +9,7 @@
 #include "optional.hh"
 #include "utils.hh"
 #include "hash_map.hh"
+#include "ref_ptr.hh"
 
 #include <functional>
 
@@ -150,6 +151,20 @@ private:
     CommandMap m_commands;
     int m_command_depth = 0;
 
+    // Command lines are tokenized once and cached by content, so that the
+    // ones run repeatedly, such as hooks, mappings and command bodies, are
+    // only expanded on each execution.
+    struct ParsedCommandLine : RefCountable
+    {
+        String command_line; // quoted token contents are not copied but refer to it
+        Vector<Token, MemoryDomain::Commands> tokens;
+        Optional<String> parse_error; // error met after the last token
+    };
+    RefPtr<ParsedCommandLine> parse_command_line(StringView command_line);
+
+    using ParsedCommandLineMap = HashMap<String, RefPtr<ParsedCommandLine>, MemoryDomain::Commands>;
+    ParsedCommandLineMap m_parsed_command_lines;
+
     struct Module
     {
         enum class State
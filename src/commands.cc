@@ -1,5 +1,6 @@
 #include "commands.hh"
 
+#include "binary_ui.hh"
 #include "buffer.hh"
 #include "buffer_manager.hh"
 #include "buffer_utils.hh"
@@ -14,9 +15,11 @@
 #include "file.hh"
 #include "hash_map.hh"
 #include "highlighter.hh"
+#include "highlighter_cache.hh"
 #include "highlighters.hh"
 #include "input_handler.hh"
 #include "insert_completer.hh"
+#include "json.hh"
 #include "normal.hh"
 #include "option_manager.hh"
 #include "option_types.hh"
@@ -51,7 +54,7 @@ extern const char* version;
 struct LocalScope : Scope
 {
     LocalScope(Context& context)
-        : Scope(context.scope()), m_context{context}
+        : Scope(context.scope(), "local"), m_context{context}
     {
         m_context.m_local_scopes.push_back(this);
     }
@@ -1590,7 +1593,8 @@ const CommandDesc debug_cmd = {
         [](const Context& context, CompletionFlags flags,
            StringView prefix, ByteCount cursor_pos) -> Completions {
                auto c = {"info", "buffers", "options", "memory", "shared-strings",
-                         "profile-hash-maps", "faces", "mappings", "regex", "registers"};
+                         "profile-hash-maps", "profile-ui-protocols", "faces", "mappings", "regex", "registers",
+                         "highlighters", "hooks", "clients"};
                return { 0_byte, cursor_pos, complete(prefix, cursor_pos, c), Completions::Flags::Menu };
     }),
     [](const ParametersParser& parser, Context& context, const ShellContext&)
@@ -1606,6 +1610,14 @@ const CommandDesc debug_cmd = {
             write_to_debug_buffer("build: release");
             #endif
         }
+        else if (parser[0] == "clients")
+        {
+            write_to_debug_buffer("Clients:");
+            for (auto& client : ClientManager::instance())
+                write_to_debug_buffer(format(" * {}: {} frames drawn, {} frames dropped",
+                                             client->context().name(), client->frames_produced(),
+                                             client->frames_dropped()));
+        }
         else if (parser[0] == "buffers")
         {
             write_to_debug_buffer("Buffers:");
@@ -1648,6 +1660,16 @@ const CommandDesc debug_cmd = {
             #elif defined(__GLIBC__) || defined(__CYGWIN__)
             write_to_debug_buffer(format("  Malloced: {}", grouped(mallinfo().uordblks)));
             #endif
+
+            auto& cache_manager = HighlighterCacheManager::instance();
+            write_to_debug_buffer({});
+            write_to_debug_buffer(format("Highlighter caches: {} (limit: {}, evicted: {})",
+                                         grouped(cache_manager.memory_usage()),
+                                         grouped((size_t)context.options()["highlight_cache_size"].get<int>() * 1024),
+                                         grouped(cache_manager.evicted_count())));
+            for (auto& usage : cache_manager.usage_per_buffer())
+                write_to_debug_buffer(format("  {}: {} in {} caches", usage.buffer->display_name(),
+                                             grouped(usage.memory_usage), usage.entry_count));
         }
         else if (parser[0] == "shared-strings")
         {
@@ -1657,6 +1679,14 @@ const CommandDesc debug_cmd = {
         {
             profile_hash_maps();
         }
+        else if (parser[0] == "profile-ui-protocols")
+        {
+            if (not context.has_window())
+                throw runtime_error("no window to profile ui protocols with");
+            const auto& faces = context.faces();
+            profile_ui_protocols(context.window().update_display_buffer(context),
+                                 faces["Default"], faces["BufferPadding"]);
+        }
         else if (parser[0] == "faces")
         {
             write_to_debug_buffer("Faces:");
@@ -1689,6 +1719,63 @@ const CommandDesc debug_cmd = {
             write_to_debug_buffer(format(" * {}:\n{}",
                                   parser[1], dump_regex(compile_regex(parser[1], RegexCompileFlags::Optimize))));
         }
+        else if (parser[0] == "highlighters")
+        {
+            auto& profiler = HighlighterProfiler::instance();
+            const StringView mode = parser.positional_count() > 1 ? parser[1] : StringView{};
+            if (mode == "reset")
+                return profiler.reset();
+            if (not mode.empty() and mode != "json")
+                throw runtime_error(format("unknown highlighters debug mode: '{}'", mode));
+
+            using Item = HighlighterProfiler::TimingMap::Item;
+            auto timings = profiler.timings() | transform([](const Item& item) { return &item; })
+                                              | gather<Vector<const Item*>>();
+            std::sort(timings.begin(), timings.end(), [](const Item* lhs, const Item* rhs) {
+                return lhs->value.total > rhs->value.total;
+            });
+            auto max_frame = [](const HighlighterProfiler::Timing& timing) {
+                return (size_t)std::max(timing.max_frame, timing.last_frame).count();
+            };
+
+            if (mode == "json")
+            {
+                write_to_debug_buffer(format("\\{{}}", join(timings | transform([&](const Item* item) {
+                    auto& timing = item->value;
+                    return format(R"({}: \{ "calls": {}, "frames": {}, "total_us": {}, "last_frame_us": {}, "max_frame_us": {} })",
+                                  to_json(item->key), timing.calls, timing.frames, (size_t)timing.total.count(),
+                                  (size_t)timing.last_frame.count(), max_frame(timing));
+                }), ", ")));
+                return;
+            }
+
+            write_to_debug_buffer("Highlighters profile:");
+            write_to_debug_buffer(format("{:12} │{:12} │{:12} │{:12} │{:12} │ {}",
+                                         "calls", "frames", "total us", "last frame", "max frame", "path"));
+            write_to_debug_buffer(format("{0}┼{0}┼{0}┼{0}┼{0}┼{1}", String(Codepoint{0x2500}, 13_col),
+                                         String(Codepoint{0x2500}, 6_col)));
+            for (auto* item : timings)
+            {
+                auto& timing = item->value;
+                write_to_debug_buffer(format("{:12} │{:12} │{:12} │{:12} │{:12} │ {}",
+                                             grouped(timing.calls), grouped(timing.frames),
+                                             grouped(timing.total.count()), grouped(timing.last_frame.count()),
+                                             grouped(max_frame(timing)), item->key));
+            }
+        }
+        else if (parser[0] == "hooks")
+        {
+            write_to_debug_buffer("Hooks profile:");
+            write_to_debug_buffer(format("{:12} │{:12} │{:12} │{:12} │ {}",
+                                         "runs", "regex runs", "rejected", "total us", "hook"));
+            write_to_debug_buffer(format("{0}┼{0}┼{0}┼{0}┼{1}", String(Codepoint{0x2500}, 13_col),
+                                         String(Codepoint{0x2500}, 6_col)));
+            if (context.has_window())
+                context.window().hooks().debug_stats("window");
+            if (context.has_buffer())
+                context.buffer().hooks().debug_stats("buffer");
+            GlobalScope::instance().hooks().debug_stats("global");
+        }
         else if (parser[0] == "registers")
         {
             write_to_debug_buffer("Register info:");
@@ -1741,11 +1828,12 @@ const CommandDesc source_cmd = {
 
 static String option_doc_helper(const Context& context, CommandParameters params)
 {
-    const bool is_switch = params.size() > 1 and (params[0] == "-add" or params[0] == "-remove");
-    if (params.size() < 2 + (is_switch ? 1 : 0))
+    const size_t switch_count = params.size() > 1 and (params[0] == "-add" or params[0] == "-remove") ? 1
+                              : params.size() > 2 and params[0] == "-lines" ? 2 : 0;
+    if (params.size() < 2 + switch_count)
         return "";
 
-    auto desc = GlobalScope::instance().option_registry().option_desc(params[1 + (is_switch ? 1 : 0)]);
+    auto desc = GlobalScope::instance().option_registry().option_desc(params[1 + switch_count]);
     if (not desc or desc->docstring().empty())
         return "";
 
@@ -1767,7 +1855,8 @@ const CommandDesc set_option_cmd = {
     "scope the option is set in",
     ParameterDesc{
         { { "add",    { {}, "add to option rather than replacing it" } },
-          { "remove", { {}, "remove from option rather than replacing it" } } },
+          { "remove", { {}, "remove from option rather than replacing it" } },
+          { "lines",  { ArgCompleter{}, "replace the elements starting in <first>,<last> lines rather than the whole option" } } },
         ParameterDesc::Flags::SwitchesOnlyAtStart, 2, (size_t)-1
     },
     CommandFlags::None,
@@ -1796,14 +1885,26 @@ const CommandDesc set_option_cmd = {
     {
         bool add = (bool)parser.get_switch("add");
         bool remove = (bool)parser.get_switch("remove");
-        if (add and remove)
-            throw runtime_error("cannot add and remove at the same time");
+        auto lines = parser.get_switch("lines");
+        if ((int)add + (int)remove + (int)(bool)lines > 1)
+            throw runtime_error("only one of -add, -remove and -lines can be used");
 
         Option& opt = get_options(parser[0], context, parser[1]).get_local_option(parser[1]);
         if (add)
             opt.add_from_strings(parser.positionals_from(2));
         else if (remove)
             opt.remove_from_strings(parser.positionals_from(2));
+        else if (lines)
+        {
+            auto comma = find(*lines, ',');
+            if (comma == lines->end())
+                throw runtime_error(format("'{}' does not follow <first>,<last> format", *lines));
+            const LineCount first = str_to_int({lines->begin(), comma});
+            const LineCount last = str_to_int({comma+1, lines->end()});
+            if (first < 1 or last < first)
+                throw runtime_error(format("invalid line span '{}'", *lines));
+            opt.replace_lines_from_strings(context, first, last, parser.positionals_from(2));
+        }
         else
             opt.set_from_strings(parser.positionals_from(2));
     }
@@ -1917,7 +2018,7 @@ const CommandDesc declare_option_cmd = {
         else if (parser[0] == "line-specs")
             opt = &reg.declare_option<TimestampedList<LineAndSpec>>(parser[1], docstring, {}, flags);
         else if (parser[0] == "range-specs")
-            opt = &reg.declare_option<TimestampedList<RangeAndString>>(parser[1], docstring, {}, flags);
+            opt = &reg.declare_option<RangeAndStringList>(parser[1], docstring, {}, flags);
         else if (parser[0] == "str-to-str-map")
             opt = &reg.declare_option<HashMap<String, String, MemoryDomain::Options>>(parser[1], docstring, {}, flags);
         else
@@ -2210,22 +2311,68 @@ const CommandDesc execute_keys_cmd = {
 };
 
 
+// The output of the script is executed in the client it was started from, or
+// in a draft context of its buffer if that client is gone or now displays another
+// buffer. It is dropped if that buffer has been deleted or modified in the mean time.
+void evaluate_async(StringView script, const Context& context, const ShellContext& shell_context, bool no_hooks)
+{
+    String client_name = context.has_client() ? context.name() : String{};
+    String buffer_name = context.buffer().name();
+    const size_t timestamp = context.buffer().timestamp();
+
+    ShellManager::instance().eval_async(script, context, shell_context,
+                                        [=](String output, int) {
+        Buffer* buffer = BufferManager::instance().get_buffer_ifp(buffer_name);
+        if (not buffer)
+            return write_to_debug_buffer(format("async evaluation dropped, buffer '{}' was deleted", buffer_name));
+        if (buffer->timestamp() != timestamp)
+            return write_to_debug_buffer(format("async evaluation dropped, buffer '{}' was modified",
+                                                buffer->display_name()));
+
+        Client* client = client_name.empty() ? nullptr : ClientManager::instance().get_client_ifp(client_name);
+        Optional<InputHandler> input_handler;
+        if (not client or &client->context().buffer() != buffer)
+            input_handler.emplace(SelectionList{*buffer, Selection{}}, Context::Flags::Draft);
+        Context& c = input_handler ? input_handler->context() : client->context();
+
+        try
+        {
+            ScopedSetBool noninteractive(c.noninteractive());
+            ScopedSetBool disable_hooks(c.hooks_disabled(), c.hooks_disabled() or no_hooks);
+            ScopedEdition edition{c};
+            LocalScope local_scope{c};
+            CommandManager::instance().execute(output, c);
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("error running async evaluation: {}", error.what()));
+        }
+    });
+}
+
 const CommandDesc evaluate_commands_cmd = {
     "evaluate-commands",
     "eval",
     "evaluate-commands [<switches>] <commands>...: execute commands as if entered by user",
-    make_context_wrap_params<3>({{
+    make_context_wrap_params<4>({{
         {"save-regs",  {ArgCompleter{}, "restore all given registers after execution (default: '')"}},
         {"no-hooks", { {}, "disable hooks while executing commands" }},
-        {"verbatim", { {}, "do not reparse argument" }}
+        {"verbatim", { {}, "do not reparse argument" }},
+        {"async", { {}, "run arguments as a shell script in the background, and execute its output once done" }}
     }}),
     CommandFlags::None,
     CommandHelper{},
     CommandManager::NestedCompleter{},
     [](const ParametersParser& parser, Context& context, const ShellContext& shell_context)
     {
+        if (parser.get_switch("async") and parser.get_switch("verbatim"))
+            throw runtime_error("-async and -verbatim cannot be used together");
+
         context_wrap(parser, context, {}, [&](const ParametersParser& parser, Context& context) {
             const bool no_hooks = context.hooks_disabled() or parser.get_switch("no-hooks");
+            if (parser.get_switch("async"))
+                return evaluate_async(join(parser, ' ', false), context, shell_context, no_hooks);
+
             ScopedSetBool disable_hooks(context.hooks_disabled(), no_hooks);
 
             LocalScope local_scope{context};
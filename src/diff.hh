@@ -48,15 +48,21 @@ Snake find_end_snake_of_further_reaching_dpath(IteratorA a, int N, IteratorB b,
 
 template<typename IteratorA, typename IteratorB, typename Equal>
 Snake find_middle_snake(IteratorA a, int N, IteratorB b, int M,
-                        int* V1, int* V2, int cost_limit, Equal&& eq)
+                        int* V1, int* V2, int cost_limit, int& total_cost, Equal&& eq)
 {
     const int delta = N - M;
     V1[1] = 0;
     V2[1] = 0;
 
-    const int max_D = std::min((M + N + 1) / 2 + 1, cost_limit);
+    int max_D = std::min((M + N + 1) / 2 + 1, cost_limit);
     for (int D = 0; D < max_D; ++D)
     {
+        if ((total_cost -= D) < 0)
+        {
+            max_D = D;
+            break;
+        }
+
         for (int k1 = -D; k1 <= D; k1 += 2)
         {
             auto p = find_end_snake_of_further_reaching_dpath<true>(a, N, b, M, V1, D, k1, eq);
@@ -112,7 +118,7 @@ enum class DiffOp
 template<typename IteratorA, typename IteratorB, typename Equal, typename OnDiff>
 void find_diff_rec(IteratorA a, int begA, int endA,
                    IteratorB b, int begB, int endB,
-                   int* V1, int* V2, int cost_limit,
+                   int* V1, int* V2, int cost_limit, int& total_cost,
                    Equal&& eq, OnDiff&& on_diff)
 {
     auto on_diff_ifn = [&](DiffOp op, int len) {
@@ -136,14 +142,19 @@ void find_diff_rec(IteratorA a, int begA, int endA,
         on_diff_ifn(DiffOp::Add, lenB);
     else if (lenB == 0)
         on_diff_ifn(DiffOp::Remove, lenA);
+    else if (total_cost <= 0) // give up on finding a short diff for the remaining range
+    {
+        on_diff(DiffOp::Remove, lenA);
+        on_diff(DiffOp::Add, lenB);
+    }
     else
     {
-        auto snake = find_middle_snake(a + begA, lenA, b + begB, lenB, V1, V2, cost_limit, eq);
+        auto snake = find_middle_snake(a + begA, lenA, b + begB, lenB, V1, V2, cost_limit, total_cost, eq);
         kak_assert(snake.u <= lenA and snake.v <= lenB);
 
         find_diff_rec(a, begA, begA + snake.x - (int)(snake.op == Snake::Del),
                       b, begB, begB + snake.y - (int)(snake.op == Snake::Add),
-                      V1, V2, cost_limit, eq, on_diff);
+                      V1, V2, cost_limit, total_cost, eq, on_diff);
 
         if (snake.op == Snake::Add)
             on_diff_ifn(DiffOp::Add, 1);
@@ -159,7 +170,7 @@ void find_diff_rec(IteratorA a, int begA, int endA,
 
         find_diff_rec(a, begA + snake.u + (int)(snake.op == Snake::RevDel), endA,
                       b, begB + snake.v + (int)(snake.op == Snake::RevAdd), endB,
-                      V1, V2, cost_limit, eq, on_diff);
+                      V1, V2, cost_limit, total_cost, eq, on_diff);
     }
 
     on_diff_ifn(DiffOp::Keep, suffix_len);
@@ -177,9 +188,11 @@ void for_each_diff(IteratorA a, int N, IteratorB b, int M, OnDiff&& on_diff, Equ
     const int max = 2 * (N + M) + 1;
     std::unique_ptr<int[]> data(new int[2*max]);
     constexpr int cost_limit = 1000;
+    // bounds the time spent on inputs with many differences, such as sorted lines
+    int total_cost = 1 << 24;
 
     Diff last{};
-    find_diff_rec(a, 0, N, b, 0, M, &data[N+M], &data[max + N+M], cost_limit, eq,
+    find_diff_rec(a, 0, N, b, 0, M, &data[N+M], &data[max + N+M], cost_limit, total_cost, eq,
                   [&last, &on_diff](DiffOp op, int len) {
                       if (last.op == op)
                           last.len += len;
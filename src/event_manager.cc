@@ -7,6 +7,11 @@
 #include <cstring>
 #endif
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include <climits>
 #include <unistd.h>
 
 namespace Kakoune
@@ -15,12 +20,24 @@ namespace Kakoune
 FDWatcher::FDWatcher(int fd, FdEvents events, EventMode mode, Callback callback)
     : m_fd{fd}, m_events{events}, m_mode{mode}, m_callback{std::move(callback)}
 {
-    EventManager::instance().m_fd_watchers.push_back(this);
+    auto& event_manager = EventManager::instance();
+    event_manager.m_fd_watchers.push_back(this);
+    event_manager.update_poll(*this);
 }
 
 FDWatcher::~FDWatcher()
 {
-    unordered_erase(EventManager::instance().m_fd_watchers, this);
+    auto& event_manager = EventManager::instance();
+    event_manager.unregister(*this);
+    unordered_erase(event_manager.m_fd_watchers, this);
+    for (auto* ready : event_manager.m_dispatching)
+    {
+        for (auto& entry : *ready)
+        {
+            if (entry.watcher == this)
+                entry.watcher = nullptr;
+        }
+    }
 }
 
 void FDWatcher::run(FdEvents events, EventMode mode)
@@ -28,26 +45,54 @@ void FDWatcher::run(FdEvents events, EventMode mode)
     m_callback(*this, events, mode);
 }
 
+void FDWatcher::set_events(FdEvents events)
+{
+    m_events = events;
+    EventManager::instance().update_poll(*this);
+}
+
+void FDWatcher::reset_fd(int fd)
+{
+    auto& event_manager = EventManager::instance();
+    event_manager.unregister(*this);
+    m_fd = fd;
+    event_manager.update_poll(*this);
+}
+
 void FDWatcher::close_fd()
 {
     if (m_fd != -1)
     {
+        EventManager::instance().unregister(*this);
         close(m_fd);
         m_fd = -1;
     }
 }
 
+void FDWatcher::disable()
+{
+    EventManager::instance().unregister(*this);
+    m_fd = -1;
+}
+
 Timer::Timer(TimePoint date, Callback callback, EventMode mode)
     : m_date{date}, m_mode(mode), m_callback{std::move(callback)}
 {
     if (m_callback and EventManager::has_instance())
-        EventManager::instance().m_timers.push_back(this);
+        EventManager::instance().add_timer(*this);
 }
 
 Timer::~Timer()
 {
-    if (m_callback and EventManager::has_instance())
-        unordered_erase(EventManager::instance().m_timers, this);
+    if (m_heap_index != unregistered)
+        EventManager::instance().remove_timer(*this);
+}
+
+void Timer::set_next_date(TimePoint date)
+{
+    m_date = date;
+    if (m_heap_index != unregistered)
+        EventManager::instance().update_timer(*this);
 }
 
 void Timer::run(EventMode mode)
@@ -55,25 +100,238 @@ void Timer::run(EventMode mode)
     kak_assert(m_callback);
     if (mode == m_mode)
     {
-        m_date = TimePoint::max();
+        set_next_date(TimePoint::max());
         m_callback(*this);
     }
     else // try again a little later
-        m_date = Clock::now() + std::chrono::milliseconds{10};
+        set_next_date(Clock::now() + std::chrono::milliseconds{10});
 }
 
 EventManager::EventManager()
 {
     FD_ZERO(&m_forced_fd);
+    create_poller();
 }
 
 EventManager::~EventManager()
 {
     kak_assert(m_fd_watchers.empty());
     kak_assert(m_timers.empty());
+    close_poller();
 }
 
-bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, bool block)
+void EventManager::add_timer(Timer& timer)
+{
+    timer.m_heap_index = m_timers.size();
+    m_timers.push_back(&timer);
+    update_timer(timer);
+}
+
+void EventManager::remove_timer(Timer& timer)
+{
+    const size_t index = timer.m_heap_index;
+    timer.m_heap_index = Timer::unregistered;
+
+    Timer* last = m_timers.back();
+    m_timers.pop_back();
+    if (last != &timer)
+    {
+        m_timers[index] = last;
+        last->m_heap_index = index;
+        update_timer(*last);
+    }
+
+    for (auto* expiring : m_expiring)
+        std::replace(expiring->begin(), expiring->end(), &timer, (Timer*)nullptr);
+}
+
+void EventManager::update_timer(Timer& timer)
+{
+    auto before = [this](size_t lhs, size_t rhs) { return m_timers[lhs]->m_date < m_timers[rhs]->m_date; };
+    auto swap_timers = [this](size_t lhs, size_t rhs) {
+        std::swap(m_timers[lhs], m_timers[rhs]);
+        m_timers[lhs]->m_heap_index = lhs;
+        m_timers[rhs]->m_heap_index = rhs;
+    };
+
+    size_t index = timer.m_heap_index;
+    while (index > 0 and before(index, (index - 1) / 2))
+    {
+        swap_timers(index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+    while (true)
+    {
+        size_t first = index;
+        for (size_t child : {2 * index + 1, 2 * index + 2})
+        {
+            if (child < m_timers.size() and before(child, first))
+                first = child;
+        }
+        if (first == index)
+            break;
+        swap_timers(index, first);
+        index = first;
+    }
+}
+
+void EventManager::create_poller()
+{
+#if defined(__linux__)
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_urgent_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // urgent epoll instance is identified by a null data pointer
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (m_epoll_fd == -1 or m_urgent_epoll_fd == -1 or
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_urgent_epoll_fd, &event) != 0)
+        close_poller(); // fallback to pselect
+#endif
+}
+
+void EventManager::close_poller()
+{
+    for (int* fd : {&m_epoll_fd, &m_urgent_epoll_fd})
+    {
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+void EventManager::reset_poller()
+{
+    if (m_epoll_fd == -1)
+        return;
+
+    close_poller();
+    create_poller();
+    m_always_ready_watchers.clear();
+    for (auto* watcher : m_fd_watchers)
+    {
+        watcher->m_polled_fd = -1;
+        watcher->m_polled_events = FdEvents::None;
+        watcher->m_always_ready = false;
+        update_poll(*watcher);
+    }
+}
+
+#if defined(__linux__)
+static uint32_t to_epoll_events(FdEvents events)
+{
+    return (events & FdEvents::Read ? (uint32_t)EPOLLIN : 0u) |
+           (events & FdEvents::Write ? (uint32_t)EPOLLOUT : 0u) |
+           (events & FdEvents::Except ? (uint32_t)EPOLLPRI : 0u);
+}
+
+static FdEvents from_epoll_events(uint32_t events)
+{
+    // hang up and errors are reported as readable and writable, as select does
+    return (events & (EPOLLIN | EPOLLHUP | EPOLLERR) ? FdEvents::Read : FdEvents::None) |
+           (events & (EPOLLOUT | EPOLLHUP | EPOLLERR) ? FdEvents::Write : FdEvents::None) |
+           (events & EPOLLPRI ? FdEvents::Except : FdEvents::None);
+}
+#endif
+
+void EventManager::update_poll(FDWatcher& watcher)
+{
+#if defined(__linux__)
+    if (m_epoll_fd == -1)
+        return;
+
+    const int fd = watcher.fd();
+    const auto events = fd != -1 ? watcher.events() : FdEvents::None;
+    if (fd == watcher.m_polled_fd and events == watcher.m_polled_events)
+        return;
+
+    if (fd != watcher.m_polled_fd or events == FdEvents::None)
+        unregister(watcher);
+    if (events == FdEvents::None)
+        return;
+
+    epoll_event event{};
+    event.events = to_epoll_events(events);
+    event.data.ptr = &watcher;
+    const int op = watcher.m_polled_fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    const int epoll_fd = watcher.mode() == EventMode::Urgent ? m_urgent_epoll_fd : m_epoll_fd;
+    // regular files cannot be polled, but are always ready for io
+    if (not watcher.m_always_ready and epoll_ctl(epoll_fd, op, fd, &event) != 0 and errno == EPERM)
+    {
+        watcher.m_always_ready = true;
+        m_always_ready_watchers.push_back(&watcher);
+    }
+
+    watcher.m_polled_fd = fd;
+    watcher.m_polled_events = events;
+#endif
+}
+
+void EventManager::unregister(FDWatcher& watcher)
+{
+#if defined(__linux__)
+    if (watcher.m_always_ready)
+        unordered_erase(m_always_ready_watchers, &watcher);
+    else if (watcher.m_polled_fd != -1)
+    {
+        const int epoll_fd = watcher.mode() == EventMode::Urgent ? m_urgent_epoll_fd : m_epoll_fd;
+        [[maybe_unused]] const int res = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watcher.m_polled_fd, nullptr);
+        // a closed fd stays registered as long as a duplicate of it is open
+        kak_assert(res == 0 or errno != EBADF);
+    }
+#endif
+    watcher.m_polled_fd = -1;
+    watcher.m_polled_events = FdEvents::None;
+    watcher.m_always_ready = false;
+}
+
+bool EventManager::poll_epoll(EventMode mode, sigset_t* sigmask, const timespec* timeout, ReadyList& ready)
+{
+#if defined(__linux__)
+    for (auto* watcher : m_always_ready_watchers)
+    {
+        if (mode == EventMode::Normal or watcher->mode() == EventMode::Urgent)
+            ready.push_back({watcher, watcher->fd(), watcher->events()});
+    }
+
+    int timeout_ms = -1;
+    if (not ready.empty())
+        timeout_ms = 0;
+    else if (timeout) // round up so that we do not wake up before the timeout
+        timeout_ms = (int)std::min<long long>(INT_MAX, timeout->tv_sec * 1000ll + (timeout->tv_nsec + 999'999) / 1'000'000);
+
+    constexpr int max_events = 64;
+    epoll_event events[max_events];
+    auto add_events = [&](epoll_event* begin, int count) {
+        for (auto& event : ArrayView{begin, (size_t)std::max(count, 0)})
+        {
+            auto* watcher = static_cast<FDWatcher*>(event.data.ptr);
+            if (auto fd_events = from_epoll_events(event.events) & watcher->m_polled_events; fd_events != FdEvents::None)
+                ready.push_back({watcher, watcher->m_polled_fd, fd_events});
+        }
+    };
+
+    const bool urgent_only = mode == EventMode::Urgent;
+    const int res = epoll_pwait(urgent_only ? m_urgent_epoll_fd : m_epoll_fd,
+                                events, max_events, timeout_ms, sigmask);
+    for (int i = 0; i < res; ++i)
+    {
+        if (events[i].data.ptr != nullptr)
+            add_events(&events[i], 1);
+        else // urgent epoll instance has ready watchers
+        {
+            epoll_event urgent_events[max_events];
+            add_events(urgent_events, epoll_wait(m_urgent_epoll_fd, urgent_events, max_events, 0));
+        }
+    }
+    return not ready.empty();
+#else
+    return false;
+#endif
+}
+
+bool EventManager::poll_select(EventMode mode, sigset_t* sigmask, const timespec* timeout, ReadyList& ready)
 {
     int max_fd = 0;
     fd_set rfds, wfds, efds;
@@ -97,6 +355,26 @@ bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, bool bl
             FD_SET(fd, &efds);
     }
 
+    if (pselect(max_fd + 1, &rfds, &wfds, &efds, timeout, sigmask) <= 0)
+        return false;
+
+    for (auto& watcher : m_fd_watchers)
+    {
+        const int fd = watcher->fd();
+        if (fd == -1 or (watcher->mode() == EventMode::Normal and mode == EventMode::Urgent))
+            continue;
+
+        auto events = (FD_ISSET(fd, &rfds) ? FdEvents::Read : FdEvents::None) |
+                      (FD_ISSET(fd, &wfds) ? FdEvents::Write : FdEvents::None) |
+                      (FD_ISSET(fd, &efds) ? FdEvents::Except : FdEvents::None);
+        if (events != FdEvents::None)
+            ready.push_back({watcher, fd, events});
+    }
+    return true;
+}
+
+bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, bool block)
+{
     bool with_timeout = false;
     if (m_has_forced_fd)
         block = false;
@@ -104,55 +382,81 @@ bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, bool bl
     timespec ts{};
     if (block and not m_timers.empty())
     {
-        auto next_date = (*std::min_element(
-            m_timers.begin(), m_timers.end(), [](Timer* lhs, Timer* rhs) {
-                return lhs->next_date() < rhs->next_date();
-        }))->next_date();
-
+        auto next_date = m_timers.front()->next_date();
         if (next_date != TimePoint::max())
         {
             with_timeout = true;
             using namespace std::chrono; using ns = std::chrono::nanoseconds;
-            auto nsecs = std::max(ns(0), duration_cast<ns>(next_date - Clock::now()));
+            auto nsecs = std::max(ns(0), duration_cast<ns>(next_date - Clock::now() + m_timer_slack));
             auto secs = duration_cast<seconds>(nsecs);
             ts = timespec{ (time_t)secs.count(), (long)(nsecs - secs).count() };
         }
     }
-    int res = pselect(max_fd + 1, &rfds, &wfds, &efds,
-                      not block or with_timeout ? &ts : nullptr, sigmask);
 
-    // copy forced fds *after* select, so that signal handlers can write to
-    // m_forced_fd, interupt select, and directly be serviced.
-    m_has_forced_fd = false;
-    fd_set forced = m_forced_fd;
-    FD_ZERO(&m_forced_fd);
+    // ready list is kept in m_dispatching so that destroyed watchers get removed from it
+    ReadyList ready;
+    m_dispatching.push_back(&ready);
+    auto pop_ready = on_scope_end([this] { m_dispatching.pop_back(); });
 
-    for (int fd = 0; fd < max_fd + 1; ++fd)
-    {
-        auto events =  FD_ISSET(fd, &forced) ? FdEvents::Read : FdEvents::None;
-        if (res > 0)
-            events |= (FD_ISSET(fd, &rfds) ? FdEvents::Read : FdEvents::None) |
-                      (FD_ISSET(fd, &wfds) ? FdEvents::Write : FdEvents::None) |
-                      (FD_ISSET(fd, &efds) ? FdEvents::Except : FdEvents::None);
+    const timespec* timeout = not block or with_timeout ? &ts : nullptr;
+    const bool res = m_epoll_fd != -1 ? poll_epoll(mode, sigmask, timeout, ready)
+                                      : poll_select(mode, sigmask, timeout, ready);
 
-        if (events != FdEvents::None)
+    // copy forced fds *after* polling, so that signal handlers can write to
+    // m_forced_fd, interupt polling, and directly be serviced.
+    if (std::exchange(m_has_forced_fd, false))
+    {
+        fd_set forced = m_forced_fd;
+        FD_ZERO(&m_forced_fd);
+        for (auto* watcher : m_fd_watchers)
         {
-            auto it = find_if(m_fd_watchers,
-                              [fd](const FDWatcher* w){return w->fd() == fd; });
-            if (it != m_fd_watchers.end())
-                (*it)->run(events, mode);
+            const int fd = watcher->fd();
+            if (fd == -1 or fd >= FD_SETSIZE or not FD_ISSET(fd, &forced))
+                continue;
+
+            auto it = find_if(ready, [&](auto& entry) { return entry.watcher == watcher; });
+            if (it != ready.end())
+                it->events |= FdEvents::Read;
+            else
+                ready.push_back({watcher, fd, FdEvents::Read});
         }
     }
 
+    for (auto& entry : ready)
+    {
+        // watcher might have been destroyed or changed fd by a previous callback
+        if (entry.watcher and entry.watcher->fd() == entry.fd)
+            entry.watcher->run(entry.events, mode);
+    }
+
+    // gather expired timers first, as running them modifies the heap, children
+    // of a timer that has not expired cannot have expired either.
     TimePoint now = Clock::now();
-    auto timers = m_timers; // copy timers in case m_timers gets mutated
-    for (auto& timer : timers)
+    Vector<Timer*, MemoryDomain::Events> expired;
+    if (not m_timers.empty() and m_timers.front()->next_date() <= now)
+        expired.push_back(m_timers.front());
+    for (size_t i = 0; i < expired.size(); ++i)
+    {
+        const size_t index = expired[i]->m_heap_index;
+        for (size_t child : {2 * index + 1, 2 * index + 2})
+        {
+            if (child < m_timers.size() and m_timers[child]->next_date() <= now)
+                expired.push_back(m_timers[child]);
+        }
+    }
+    std::sort(expired.begin(), expired.end(),
+              [](Timer* lhs, Timer* rhs) { return lhs->next_date() < rhs->next_date(); });
+
+    // expired list is kept in m_expiring so that destroyed timers get removed from it
+    m_expiring.push_back(&expired);
+    auto pop_expired = on_scope_end([this] { m_expiring.pop_back(); });
+    for (auto* timer : expired)
     {
-        if (contains(m_timers, timer) and timer->next_date() <= now)
+        if (timer and timer->next_date() <= now)
             timer->run(mode);
     }
 
-    return res > 0;
+    return res;
 }
 
 void EventManager::force_signal(int fd)
@@ -41,20 +41,29 @@ public:
 
     int fd() const { return m_fd; }
     FdEvents events() const { return m_events; }
-    FdEvents& events() { return m_events; }
+    void set_events(FdEvents events);
     EventMode mode() const { return m_mode; }
 
     void run(FdEvents events, EventMode mode);
 
-    void reset_fd(int fd) { m_fd = fd; }
+    // the watcher must be disabled or closed through these before its fd
+    // gets closed, as the poller would otherwise keep reporting it
+    void reset_fd(int fd);
     void close_fd();
-    void disable() { m_fd = -1; }
+    void disable();
 
 private:
+    friend class EventManager;
+
     int      m_fd;
     FdEvents m_events;
     EventMode m_mode;
     Callback m_callback;
+
+    // registration state in the event manager poller
+    int      m_polled_fd = -1;
+    FdEvents m_polled_events = FdEvents::None;
+    bool     m_always_ready = false;
 };
 
 class Timer
@@ -69,14 +78,18 @@ public:
     ~Timer();
 
     TimePoint next_date() const { return m_date; }
-    void set_next_date(TimePoint date) { m_date = date; }
-    void disable() { m_date = TimePoint::max(); }
+    void set_next_date(TimePoint date);
+    void disable() { set_next_date(TimePoint::max()); }
     void run(EventMode mode);
 
 private:
+    friend class EventManager;
+    static constexpr size_t unregistered = -1;
+
     TimePoint m_date;
     EventMode m_mode;
     Callback  m_callback;
+    size_t    m_heap_index = unregistered; // position in the event manager timer heap
 };
 
 // The EventManager provides an interface to file descriptor
@@ -84,6 +97,12 @@ private:
 //
 // The program main loop should call handle_next_events()
 // until it's time to quit.
+//
+// On Linux, watchers are polled through epoll, urgent watchers being
+// registered in a separate epoll instance which is itself polled by
+// the main one, other platforms, or failure to create the epoll
+// instances, fallback to pselect. Watchers are registered as soon as
+// they are created or changed, so that polling does not visit them all.
 class EventManager : public Singleton<EventManager>
 {
 public:
@@ -98,14 +117,48 @@ public:
 
     static void handle_urgent_events();
 
+    // timers can be run up to slack late, so that close timers get run
+    // together instead of each waking up the event manager.
+    void set_timer_slack(Clock::duration slack) { m_timer_slack = slack; }
+
+    // recreate the poller, to be called in a forked process that keeps
+    // running, so that changes to its watchers do not affect the other one.
+    void reset_poller();
+
 private:
     friend class FDWatcher;
     friend class Timer;
+
+    struct ReadyWatcher
+    {
+        FDWatcher* watcher;
+        int fd;
+        FdEvents events;
+    };
+    using ReadyList = Vector<ReadyWatcher, MemoryDomain::Events>;
+
+    void create_poller();
+    void close_poller();
+    void add_timer(Timer& timer);
+    void remove_timer(Timer& timer);
+    void update_timer(Timer& timer);
+    void update_poll(FDWatcher& watcher);
+    void unregister(FDWatcher& watcher);
+    bool poll_epoll(EventMode mode, sigset_t* sigmask, const timespec* timeout, ReadyList& ready);
+    bool poll_select(EventMode mode, sigset_t* sigmask, const timespec* timeout, ReadyList& ready);
+
     Vector<FDWatcher*, MemoryDomain::Events> m_fd_watchers;
-    Vector<Timer*, MemoryDomain::Events>     m_timers;
+    Vector<FDWatcher*, MemoryDomain::Events> m_always_ready_watchers; // not pollable by epoll
+    Vector<Timer*, MemoryDomain::Events>     m_timers; // min heap on next date
+    Vector<ReadyList*, MemoryDomain::Events> m_dispatching;
+    Vector<Vector<Timer*, MemoryDomain::Events>*, MemoryDomain::Events> m_expiring;
+    Clock::duration m_timer_slack{};
     fd_set m_forced_fd;
     bool   m_has_forced_fd = false;
 
+    int m_epoll_fd = -1;        // normal watchers, and the urgent epoll instance
+    int m_urgent_epoll_fd = -1; // urgent watchers
+
     TimePoint m_last;
 };
 
@@ -58,6 +58,8 @@ private:
 FaceSpec parse_face(StringView facedesc);
 String to_string(Face face);
 
+uint32_t compute_faces_hash(const FaceRegistry& faces);
+
 }
 
 #endif // face_registry_hh_INCLUDED
@@ -35,6 +35,12 @@ constexpr size_t hash_value(const Type& val)
     return hash_value((std::underlying_type_t<Type>)val);
 }
 
+template<typename Type>
+size_t hash_value(Type* const& ptr)
+{
+    return hash_value(reinterpret_cast<uintptr_t>(ptr));
+}
+
 template<typename Type>
 constexpr size_t hash_values(Type&& t)
 {
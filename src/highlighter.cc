@@ -10,6 +10,7 @@ void Highlighter::highlight(HighlightContext context, DisplayBuffer& display_buf
 {
     if (context.pass & m_passes) try
     {
+        HighlighterProfiler::ScopedTiming timing{HighlighterProfiler::instance()};
         do_highlight(context, display_buffer, range);
     }
     catch (runtime_error& error)
@@ -53,4 +54,41 @@ Completions Highlighter::complete_child(StringView path, ByteCount cursor_pos, b
 void Highlighter::fill_unique_ids(Vector<StringView>& unique_ids) const
 {}
 
+size_t Highlighter::s_config_version = 0;
+
+bool Highlighter::depends_on_buffer_only() const
+{
+    return false;
+}
+
+HighlighterProfiler::ScopedTiming::ScopedTiming(HighlighterProfiler& profiler)
+    : m_profiler{profiler.m_active and profiler.m_path.length() != profiler.m_timed_length ? &profiler : nullptr}
+{
+    if (not m_profiler)
+        return;
+    m_parent_timed_length = m_profiler->m_timed_length;
+    m_profiler->m_timed_length = m_profiler->m_path.length();
+    m_start = Clock::now();
+}
+
+HighlighterProfiler::ScopedTiming::~ScopedTiming()
+{
+    if (not m_profiler)
+        return;
+
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_start);
+    auto& timing = m_profiler->m_timings[m_profiler->m_path];
+    if (timing.frame_id != m_profiler->m_frame_id)
+    {
+        timing.max_frame = std::max(timing.max_frame, timing.last_frame);
+        timing.last_frame = {};
+        timing.frame_id = m_profiler->m_frame_id;
+        ++timing.frames;
+    }
+    timing.last_frame += duration;
+    timing.total += duration;
+    ++timing.calls;
+    m_profiler->m_timed_length = m_parent_timed_length;
+}
+
 }
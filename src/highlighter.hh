@@ -1,6 +1,7 @@
 #ifndef highlighter_hh_INCLUDED
 #define highlighter_hh_INCLUDED
 
+#include "clock.hh"
 #include "coord.hh"
 #include "completion.hh"
 #include "range.hh"
@@ -9,6 +10,7 @@
 #include "string.hh"
 #include "utils.hh"
 #include "parameters_parser.hh"
+#include "value.hh"
 
 #include <memory>
 
@@ -58,6 +60,9 @@ struct HighlightContext
     const DisplaySetup& setup;
     HighlightPass pass;
     HighlighterIdList disabled_ids;
+    // set for the direct children of a scope highlighter group, whose
+    // output can be shared between windows, see highlight_shared
+    bool shared = false;
 };
 
 struct Highlighter
@@ -75,13 +80,28 @@ struct Highlighter
     virtual Completions complete_child(StringView path, ByteCount cursor_pos, bool group) const;
     virtual void fill_unique_ids(Vector<StringView>& unique_ids) const;
 
+    // true if the highlighter colorize pass only depends on the buffer
+    // content and the faces, so that its result can be shared by all
+    // windows displaying the same buffer lines
+    virtual bool depends_on_buffer_only() const;
+    virtual ValueId shared_cache_id() const { return m_shared_cache_id; }
+
     HighlightPass passes() const { return m_passes; }
 
+    // incremented whenever a highlighter is added, removed or reconfigured
+    // anywhere, so that results shared between windows are not reused
+    static size_t config_version() { return s_config_version; }
+
+protected:
+    static void on_config_changed() { ++s_config_version; }
+
 private:
     virtual void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange range) = 0;
     virtual void do_compute_display_setup(HighlightContext context, DisplaySetup& setup) const {}
 
     const HighlightPass m_passes;
+    const ValueId m_shared_cache_id = get_free_value_id();
+    static size_t s_config_version;
 };
 
 using HighlighterParameters = ConstArrayView<String>;
@@ -103,6 +123,73 @@ struct HighlighterRegistry : HashMap<String, HighlighterFactoryAndDescription, M
                              Singleton<HighlighterRegistry>
 {};
 
+// Gathers time spent in each highlighter, identified by its path
+// (for example window/python/code/keywords), while a profiled frame
+// is being highlighted.
+class HighlighterProfiler : public Singleton<HighlighterProfiler>
+{
+public:
+    struct Timing
+    {
+        std::chrono::microseconds total{};
+        std::chrono::microseconds last_frame{};
+        std::chrono::microseconds max_frame{};
+        size_t calls = 0;
+        size_t frames = 0;
+        size_t frame_id = 0;
+    };
+    using TimingMap = HashMap<String, Timing, MemoryDomain::Highlight>;
+
+    bool active() const { return m_active; }
+    const TimingMap& timings() const { return m_timings; }
+    void reset() { m_timings.clear(); }
+
+    [[nodiscard]] auto frame(bool active)
+    {
+        m_active = active;
+        m_path.clear();
+        if (active)
+            ++m_frame_id;
+        return on_scope_end([this] { m_active = false; });
+    }
+
+    [[nodiscard]] auto enter(StringView name)
+    {
+        const ByteCount length = m_path.length();
+        if (m_active)
+        {
+            if (not m_path.empty())
+                m_path += '/';
+            m_path += name;
+        }
+        return on_scope_end([this, length] {
+            if (m_path.length() != length)
+                m_path.resize(length, 0);
+        });
+    }
+
+    class ScopedTiming
+    {
+    public:
+        ScopedTiming(HighlighterProfiler& profiler);
+        ~ScopedTiming();
+
+    private:
+        HighlighterProfiler* m_profiler;
+        ByteCount m_parent_timed_length;
+        TimePoint m_start;
+    };
+
+private:
+    bool m_active = false;
+    size_t m_frame_id = 0;
+    String m_path;
+    // length of the path being timed, to avoid timing again
+    // delegated highlighters that share the path of their parent
+    ByteCount m_timed_length = -1;
+    TimingMap m_timings;
+};
+
 }
 
 #endif // highlighter_hh_INCLUDED
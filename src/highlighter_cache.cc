@@ -0,0 +1,127 @@
+#include "highlighter_cache.hh"
+
+#include "unit_tests.hh"
+
+namespace Kakoune
+{
+
+HighlighterCacheEntry::~HighlighterCacheEntry()
+{
+    if (m_linked)
+        HighlighterCacheManager::instance().remove(*this);
+}
+
+HighlighterCacheManager::~HighlighterCacheManager()
+{
+    for (auto* entry = m_first; entry; entry = entry->m_next)
+        entry->m_linked = false;
+}
+
+void HighlighterCacheManager::touch(HighlighterCacheEntry& entry)
+{
+    entry.m_used = true;
+    if (m_first == &entry)
+        return;
+
+    if (entry.m_linked)
+        unlink(entry);
+    link_front(entry);
+}
+
+void HighlighterCacheManager::enforce_budget(size_t budget)
+{
+    // used entries have been moved to the front of the list
+    for (auto* entry = m_first; entry and entry->m_used; entry = entry->m_next)
+    {
+        entry->m_used = false;
+        m_memory_usage -= entry->m_memory_usage;
+        entry->m_memory_usage = entry->compute_memory_usage();
+        m_memory_usage += entry->m_memory_usage;
+    }
+
+    while (m_memory_usage > budget and m_last)
+    {
+        auto& entry = *m_last;
+        remove(entry);
+        entry.clear();
+        ++m_evicted_count;
+    }
+}
+
+Vector<HighlighterCacheManager::BufferUsage> HighlighterCacheManager::usage_per_buffer() const
+{
+    Vector<BufferUsage> res;
+    for (auto* entry = m_first; entry; entry = entry->m_next)
+    {
+        auto it = find_if(res, [&](auto& usage) { return usage.buffer == &entry->buffer(); });
+        if (it == res.end())
+            it = res.insert(it, {&entry->buffer(), 0, 0});
+        it->memory_usage += entry->m_memory_usage;
+        ++it->entry_count;
+    }
+    std::sort(res.begin(), res.end(), [](auto& lhs, auto& rhs) { return lhs.memory_usage > rhs.memory_usage; });
+    return res;
+}
+
+void HighlighterCacheManager::link_front(HighlighterCacheEntry& entry)
+{
+    kak_assert(not entry.m_linked);
+    entry.m_prev = nullptr;
+    entry.m_next = m_first;
+    if (m_first)
+        m_first->m_prev = &entry;
+    else
+        m_last = &entry;
+    m_first = &entry;
+    entry.m_linked = true;
+}
+
+void HighlighterCacheManager::unlink(HighlighterCacheEntry& entry)
+{
+    kak_assert(entry.m_linked);
+    (entry.m_prev ? entry.m_prev->m_next : m_first) = entry.m_next;
+    (entry.m_next ? entry.m_next->m_prev : m_last) = entry.m_prev;
+    entry.m_prev = entry.m_next = nullptr;
+    entry.m_linked = false;
+}
+
+void HighlighterCacheManager::remove(HighlighterCacheEntry& entry)
+{
+    unlink(entry);
+    m_memory_usage -= entry.m_memory_usage;
+    entry.m_memory_usage = 0;
+}
+
+UnitTest test_highlighter_cache{[]()
+{
+    struct TestCache
+    {
+        Vector<int> data;
+        size_t memory_usage() const { return data.size() * sizeof(int); }
+    };
+
+    auto& manager = HighlighterCacheManager::instance();
+    const size_t initial_usage = manager.memory_usage();
+    {
+        auto make_lines = [](auto&&... lines) { return BufferLines{StringData::create(lines)...}; };
+        Buffer first("first", Buffer::Flags::None, make_lines("a\n"));
+        Buffer second("second", Buffer::Flags::None, make_lines("b\n"));
+
+        BufferSideCache<TestCache> cache;
+        cache.get(first).data.resize(100);
+        cache.get(second).data.resize(100);
+        manager.enforce_budget(-1);
+        kak_assert(manager.memory_usage() >= initial_usage + 200 * sizeof(int));
+
+        // first is the least recently used, and should be evicted
+        manager.enforce_budget(manager.memory_usage() - 1);
+        kak_assert(cache.get(first).data.empty());
+        kak_assert(cache.get(second).data.size() == 100);
+
+        cache.get(first).data.resize(10);
+        manager.enforce_budget(-1);
+    }
+    kak_assert(manager.memory_usage() == initial_usage);
+}};
+
+}
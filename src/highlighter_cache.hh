@@ -0,0 +1,112 @@
+#ifndef highlighter_cache_hh_INCLUDED
+#define highlighter_cache_hh_INCLUDED
+
+#include "buffer.hh"
+#include "utils.hh"
+#include "value.hh"
+
+namespace Kakoune
+{
+
+// Data computed by a highlighter for a given buffer, entries are kept by
+// the HighlighterCacheManager in least recently used order so that the
+// oldest ones can be cleared when the caches use too much memory.
+class HighlighterCacheEntry
+{
+public:
+    HighlighterCacheEntry(const Buffer& buffer) : m_buffer{buffer} {}
+    virtual ~HighlighterCacheEntry();
+
+    HighlighterCacheEntry(const HighlighterCacheEntry&) = delete;
+    HighlighterCacheEntry& operator=(const HighlighterCacheEntry&) = delete;
+
+    const Buffer& buffer() const { return m_buffer; }
+    size_t memory_usage() const { return m_memory_usage; }
+
+private:
+    friend class HighlighterCacheManager;
+
+    virtual size_t compute_memory_usage() const = 0;
+    virtual void clear() = 0;
+
+    const Buffer& m_buffer;
+    HighlighterCacheEntry* m_prev = nullptr;
+    HighlighterCacheEntry* m_next = nullptr;
+    size_t m_memory_usage = 0;
+    bool m_linked = false;
+    bool m_used = false;
+};
+
+class HighlighterCacheManager : public Singleton<HighlighterCacheManager>
+{
+public:
+    ~HighlighterCacheManager();
+
+    // mark entry as the most recently used one
+    void touch(HighlighterCacheEntry& entry);
+
+    // update memory usage of entries used since last call, and clear
+    // the least recently used ones until memory usage fits in budget
+    void enforce_budget(size_t budget);
+
+    size_t memory_usage() const { return m_memory_usage; }
+    size_t evicted_count() const { return m_evicted_count; }
+
+    struct BufferUsage
+    {
+        const Buffer* buffer;
+        size_t memory_usage;
+        size_t entry_count;
+    };
+    Vector<BufferUsage> usage_per_buffer() const;
+
+private:
+    friend class HighlighterCacheEntry;
+
+    void link_front(HighlighterCacheEntry& entry);
+    void unlink(HighlighterCacheEntry& entry);
+    void remove(HighlighterCacheEntry& entry);
+
+    HighlighterCacheEntry* m_first = nullptr;
+    HighlighterCacheEntry* m_last = nullptr;
+    size_t m_memory_usage = 0;
+    size_t m_evicted_count = 0;
+};
+
+// Get the T instance stored in buffer values at the given id, T is expected
+// to provide a memory_usage() method and to be rebuildable from its default state.
+template<typename T>
+T& get_buffer_side_cache(const Buffer& buffer, ValueId id)
+{
+    struct Entry : HighlighterCacheEntry
+    {
+        using HighlighterCacheEntry::HighlighterCacheEntry;
+
+        size_t compute_memory_usage() const override { return sizeof(T) + content.memory_usage(); }
+        void clear() override { content = T{}; }
+
+        T content;
+    };
+
+    Value& cache_val = buffer.values()[id];
+    if (not cache_val)
+        cache_val = Value(Meta::Type<Entry>{}, buffer);
+    auto& entry = cache_val.as<Entry>();
+    HighlighterCacheManager::instance().touch(entry);
+    return entry.content;
+}
+
+template<typename T>
+struct BufferSideCache
+{
+    BufferSideCache() : m_id{get_free_value_id()} {}
+
+    T& get(const Buffer& buffer) { return get_buffer_side_cache<T>(buffer, m_id); }
+
+private:
+    ValueId m_id;
+};
+
+}
+
+#endif // highlighter_cache_hh_INCLUDED
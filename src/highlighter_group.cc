@@ -2,6 +2,7 @@
 
 #include "flags.hh"
 #include "format.hh"
+#include "highlighters.hh"
 #include "ranges.hh"
 
 
@@ -10,8 +11,12 @@ namespace Kakoune
 
 void HighlighterGroup::do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange range)
 {
+    auto& profiler = HighlighterProfiler::instance();
     for (auto& hl : m_highlighters)
-        hl.value->highlight(context, display_buffer, range);
+    {
+        auto path = profiler.enter(hl.key);
+        highlight_shared(*hl.value, context, display_buffer, range);
+    }
 }
 
 void HighlighterGroup::do_compute_display_setup(HighlightContext context, DisplaySetup& setup) const
@@ -26,6 +31,11 @@ void HighlighterGroup::fill_unique_ids(Vector<StringView>& unique_ids) const
         hl.value->fill_unique_ids(unique_ids);
 }
 
+bool HighlighterGroup::depends_on_buffer_only() const
+{
+    return all_of(m_highlighters, [](auto& hl) { return hl.value->depends_on_buffer_only(); });
+}
+
 void HighlighterGroup::add_child(String name, std::unique_ptr<Highlighter>&& hl, bool override)
 {
     if ((hl->passes() & passes()) != hl->passes())
@@ -37,10 +47,10 @@ void HighlighterGroup::add_child(String name, std::unique_ptr<Highlighter>&& hl,
         if (not override)
             throw runtime_error(format("duplicate id: '{}'", name));
         it->value = std::move(hl);
-        return;
     }
-
-    m_highlighters.insert({std::move(name), std::move(hl)});
+    else
+        m_highlighters.insert({std::move(name), std::move(hl)});
+    on_config_changed();
 }
 
 void HighlighterGroup::remove_child(StringView id)
@@ -49,6 +59,7 @@ void HighlighterGroup::remove_child(StringView id)
     if (it == m_highlighters.end())
         throw child_not_found(format("no such id: '{}'", id));
     m_highlighters.remove(it);
+    on_config_changed();
 }
 
 Highlighter& HighlighterGroup::get_child(StringView path)
@@ -91,7 +102,10 @@ void Highlighters::highlight(HighlightContext context, DisplayBuffer& display_bu
 
     if (m_parent)
         m_parent->highlight({context.context, context.setup, context.pass, disabled_ids}, display_buffer, range);
-    m_group.highlight(context, display_buffer, range);
+
+    auto path = HighlighterProfiler::instance().enter(m_name);
+    m_group.highlight({context.context, context.setup, context.pass, context.disabled_ids, true},
+                      display_buffer, range);
 }
 
 void Highlighters::compute_display_setup(HighlightContext context, DisplaySetup& setup) const
@@ -30,6 +30,8 @@ public:
 
     void fill_unique_ids(Vector<StringView>& unique_ids) const override;
 
+    bool depends_on_buffer_only() const override;
+
 protected:
     void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange range) override;
     void do_compute_display_setup(HighlightContext context, DisplaySetup& setup) const override;
@@ -41,7 +43,8 @@ protected:
 class Highlighters : public SafeCountable
 {
 public:
-    Highlighters(Highlighters& parent) : SafeCountable{}, m_parent{&parent}, m_group{HighlightPass::All} {}
+    Highlighters(Highlighters& parent, StringView name)
+        : SafeCountable{}, m_parent{&parent}, m_group{HighlightPass::All}, m_name{name} {}
 
     void reparent(Highlighters& parent) { m_parent = &parent; }
 
@@ -53,10 +56,11 @@ public:
 
 private:
     friend class Scope;
-    Highlighters() : m_group{HighlightPass::All} {}
+    Highlighters() : m_group{HighlightPass::All}, m_name{"global"} {}
 
     SafePtr<Highlighters> m_parent;
     HighlighterGroup m_group;
+    StringView m_name;
 };
 
 struct SharedHighlighters : public HighlighterGroup,
@@ -8,6 +8,7 @@
 #include "context.hh"
 #include "display_buffer.hh"
 #include "face_registry.hh"
+#include "highlighter_cache.hh"
 #include "highlighter_group.hh"
 #include "line_modification.hh"
 #include "option_types.hh"
@@ -134,39 +135,172 @@ auto apply_face = [](const Face& face)
     };
 };
 
-const HighlighterDesc fill_desc = {
-    "Fill the whole highlighted range with the given face",
-    {}
-};
-static std::unique_ptr<Highlighter> create_fill_highlighter(HighlighterParameters params, Highlighter*)
+using BufferRangeList = Vector<BufferRange, MemoryDomain::Highlight>;
+
+// Returns the display buffer range, split around long lines that are only
+// partially displayed (see the long_line_length option) so that highlighters
+// can skip their hidden parts.
+static BufferRangeList displayed_ranges(const Context& context, const DisplayBuffer& display_buffer)
 {
-    if (params.size() != 1)
-        throw runtime_error("wrong parameter count");
+    const Buffer& buffer = context.buffer();
+    const ByteCount long_line_length = context.options()["long_line_length"].get<int>();
+    auto is_clipped = [&](const BufferRange& range) {
+        if (range.begin == range.end)
+            return false;
+        const ByteCount length = buffer[range.begin.line].length();
+        return length > long_line_length and
+               (range.begin.column != 0 or range.end != BufferCoord{range.begin.line, length});
+    };
 
-    return make_highlighter(
-        [spec=parse_face(params[0])](HighlightContext context, DisplayBuffer& display_buffer,
-                                     BufferRange range) {
-            highlight_range(display_buffer, range.begin, range.end, false,
-                            apply_face(context.context.faces()[spec]));
-        });
+    if (long_line_length <= 0 or not any_of(display_buffer.lines(), [&](auto& line) { return is_clipped(line.range()); }))
+        return {display_buffer.range()};
+
+    BufferRangeList ranges;
+    for (auto& line : display_buffer.lines())
+    {
+        const auto& range = line.range();
+        if (range.begin == range.end)
+            continue;
+        if (not ranges.empty() and
+            (ranges.back().end == range.begin or
+             (range.begin.column == 0 and range.begin.line > 0 and
+              ranges.back().end == BufferCoord{range.begin.line - 1, buffer[range.begin.line - 1].length()})))
+            ranges.back().end = range.end;
+        else
+            ranges.push_back(range);
+    }
+    return ranges;
 }
 
-template<typename T>
-struct BufferSideCache
+struct SharedHighlights
 {
-    BufferSideCache() : m_id{get_free_value_id()} {}
+    struct Span
+    {
+        BufferCoord begin;
+        BufferCoord end;
+        Face face;
+    };
+
+    struct Entry
+    {
+        size_t config_version;
+        size_t timestamp;
+        uint32_t faces_hash;
+        BufferRangeList displayed;
+        BufferRange range;
+        // spans are only recorded once the same entry is requested again,
+        // to avoid the recording overhead for one shot highlighting
+        bool recorded;
+        Vector<Span, MemoryDomain::Highlight> spans;
+    };
+
+    static constexpr size_t max_entries = 4;
+    Vector<Entry, MemoryDomain::Highlight> entries;
 
-    T& get(const Buffer& buffer)
+    size_t memory_usage() const
     {
-        Value& cache_val = buffer.values()[m_id];
-        if (not cache_val)
-            cache_val = Value(T{});
-        return cache_val.as<T>();
+        return accumulate(entries, entries.capacity() * sizeof(Entry),
+                          [](size_t size, const Entry& entry) {
+                              return size + entry.spans.capacity() * sizeof(Span) +
+                                     entry.displayed.capacity() * sizeof(BufferRange);
+                          });
+    }
+};
+
+void highlight_shared(Highlighter& highlighter, HighlightContext context,
+                      DisplayBuffer& display_buffer, BufferRange range)
+{
+    const bool shared = std::exchange(context.shared, false);
+    if (not shared or context.pass != HighlightPass::Colorize or
+        display_buffer.lines().empty() or not highlighter.depends_on_buffer_only())
+        return highlighter.highlight(context, display_buffer, range);
+
+    HighlighterProfiler::ScopedTiming timing{HighlighterProfiler::instance()};
+
+    const Buffer& buffer = context.context.buffer();
+    auto displayed = displayed_ranges(context.context, display_buffer);
+    const size_t config_version = Highlighter::config_version();
+    const size_t timestamp = buffer.timestamp();
+    const uint32_t faces_hash = compute_faces_hash(context.context.faces());
+
+    auto& entries = get_buffer_side_cache<SharedHighlights>(buffer, highlighter.shared_cache_id()).entries;
+    auto it = find_if(entries, [&](const SharedHighlights::Entry& entry) {
+        return entry.config_version == config_version and
+               entry.timestamp == timestamp and entry.faces_hash == faces_hash and
+               entry.displayed == displayed and entry.range == range;
+    });
+    if (it == entries.end())
+    {
+        if (entries.size() == SharedHighlights::max_entries)
+            entries.erase(entries.begin());
+        entries.push_back({config_version, timestamp, faces_hash, std::move(displayed), range, false, {}});
+        return highlighter.highlight(context, display_buffer, range);
+    }
+
+    // keep most recently used entries at the back
+    std::rotate(it, it+1, entries.end());
+    auto& entry = entries.back();
+    if (not entry.recorded)
+    {
+        DisplayBuffer plain_buffer;
+        for (auto& displayed_range : entry.displayed)
+        {
+            const auto [begin, end] = displayed_range;
+            for (LineCount line = begin.line; line <= end.line and line < buffer.line_count(); ++line)
+                plain_buffer.lines().emplace_back(AtomList{{buffer, {line == begin.line ? begin : line,
+                                                                     line == end.line ? end : BufferCoord{line, buffer[line].length()}}}});
+        }
+        plain_buffer.compute_range();
+        highlighter.highlight(context, plain_buffer, range);
+
+        for (auto& line : plain_buffer.lines())
+        {
+            for (auto& atom : line)
+            {
+                if (not atom.has_buffer_range() or atom.face == Face{})
+                    continue;
+                if (not entry.spans.empty() and entry.spans.back().end == atom.begin() and
+                    entry.spans.back().face == atom.face)
+                    entry.spans.back().end = atom.end();
+                else
+                    entry.spans.push_back({atom.begin(), atom.end(), atom.face});
+            }
+        }
+        entry.recorded = true;
     }
+
+    for (auto& span : entry.spans)
+        highlight_range(display_buffer, span.begin, span.end, false, apply_face(span.face));
+}
+
+const HighlighterDesc fill_desc = {
+    "Fill the whole highlighted range with the given face",
+    {}
+};
+struct FillHighlighter : Highlighter
+{
+    FillHighlighter(FaceSpec spec) : Highlighter{HighlightPass::Colorize}, m_spec{std::move(spec)} {}
+
+    bool depends_on_buffer_only() const override { return true; }
+
 private:
-    ValueId m_id;
+    void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange range) override
+    {
+        highlight_range(display_buffer, range.begin, range.end, false,
+                        apply_face(context.context.faces()[m_spec]));
+    }
+
+    const FaceSpec m_spec;
 };
 
+static std::unique_ptr<Highlighter> create_fill_highlighter(HighlighterParameters params, Highlighter*)
+{
+    if (params.size() != 1)
+        throw runtime_error("wrong parameter count");
+
+    return std::make_unique<FillHighlighter>(parse_face(params[0]));
+}
+
 using FacesSpec = Vector<std::pair<size_t, FaceSpec>, MemoryDomain::Highlight>;
 
 const HighlighterDesc regex_desc = {
@@ -199,26 +333,36 @@ public:
                 return faces[spec.second];
             }) | gather<Vector<Face>>();
 
-        const auto& matches = get_matches(context.context.buffer(), display_buffer.range(), range);
-        kak_assert(matches.size() % m_faces.size() == 0);
-        for (size_t m = 0; m < matches.size(); ++m)
+        const ByteCount long_line_length = context.context.options()["long_line_length"].get<int>();
+        for (auto& display_range : displayed_ranges(context.context, display_buffer))
         {
-            auto& face = faces[m % faces.size()];
-            if (face == Face{})
+            if (not overlaps(display_range, range))
                 continue;
 
-            highlight_range(display_buffer,
-                            matches[m].begin, matches[m].end,
-                            false, apply_face(face));
+            const auto& matches = get_matches(context.context.buffer(), display_range, range, long_line_length);
+            kak_assert(matches.size() % m_faces.size() == 0);
+            for (size_t m = 0; m < matches.size(); ++m)
+            {
+                auto& face = faces[m % faces.size()];
+                if (face == Face{})
+                    continue;
+
+                highlight_range(display_buffer,
+                                matches[m].begin, matches[m].end,
+                                false, apply_face(face));
+            }
         }
     }
 
+    bool depends_on_buffer_only() const override { return true; }
+
     void reset(Regex regex, FacesSpec faces)
     {
         m_regex = std::move(regex);
         m_faces = std::move(faces);
         ensure_first_face_is_capture_0();
         ++m_regex_version;
+        on_config_changed();
     }
 
     static std::unique_ptr<Highlighter> create(HighlighterParameters params, Highlighter*)
@@ -257,6 +401,18 @@ private:
         struct RangeAndMatches { BufferRange range; MatchList matches; };
         using RangeAndMatchesList = Vector<RangeAndMatches, MemoryDomain::Highlight>;
         HashMap<BufferRange, RangeAndMatchesList, MemoryDomain::Highlight> m_matches;
+
+        size_t memory_usage() const
+        {
+            size_t res = m_matches.size() * sizeof(decltype(m_matches)::Item);
+            for (auto& [range, list] : m_matches)
+            {
+                res += list.capacity() * sizeof(RangeAndMatches);
+                for (auto& range_and_matches : list)
+                    res += range_and_matches.matches.capacity() * sizeof(BufferRange);
+            }
+            return res;
+        }
     };
     BufferSideCache<Cache> m_cache;
 
@@ -295,13 +451,13 @@ private:
         }
     }
 
-    const MatchList& get_matches(const Buffer& buffer, BufferRange display_range, BufferRange buffer_range)
+    const MatchList& get_matches(const Buffer& buffer, BufferRange display_range, BufferRange buffer_range,
+                                 ByteCount long_line_length)
     {
         Cache& cache = m_cache.get(buffer);
 
         if (cache.m_regex_version != m_regex_version or
-            cache.m_timestamp != buffer.timestamp() or
-            accumulate(cache.m_matches, (size_t)0, [](size_t c, auto&& m) { return c + m.value.size(); }) > 1000)
+            cache.m_timestamp != buffer.timestamp())
         {
             cache.m_matches.clear();
             cache.m_timestamp = buffer.timestamp();
@@ -310,9 +466,32 @@ private:
 
         auto& matches = cache.m_matches[buffer_range];
 
+        // match a few lines around the displayed ones, long lines are not
+        // included, and only the part around their displayed columns is matched.
+        auto is_long = [&](LineCount line) {
+            return long_line_length > 0 and buffer[line].length() > long_line_length;
+        };
         const LineCount line_offset = 3;
-        BufferRange range{std::max<BufferCoord>(buffer_range.begin, display_range.begin.line - line_offset),
-                          std::min<BufferCoord>(buffer_range.end, display_range.end.line + line_offset)};
+        const ByteCount long_line_offset = 1024;
+        BufferCoord begin = display_range.begin;
+        if (is_long(begin.line) and begin.column != 0)
+            begin.column = std::max(0_byte, begin.column - long_line_offset);
+        else
+        {
+            begin.column = 0;
+            for (LineCount offset = 0; offset < line_offset and begin.line > 0 and not is_long(begin.line - 1); ++offset)
+                --begin.line;
+        }
+        BufferCoord end = display_range.end;
+        if (is_long(end.line) and end.column + long_line_offset < buffer[end.line].length())
+            end.column += long_line_offset;
+        else
+        {
+            end = end.line + 1;
+            for (LineCount offset = 1; offset < line_offset and end.line < buffer.line_count() and not is_long(end.line); ++offset)
+                ++end.line;
+        }
+        BufferRange range{std::max(buffer_range.begin, begin), std::min(buffer_range.end, end)};
 
         auto it = std::upper_bound(matches.begin(), matches.end(), range.begin,
                                    [](const BufferCoord& lhs, const Cache::RangeAndMatches& rhs)
@@ -604,6 +783,7 @@ struct WrapHighlighter : Highlighter
     static constexpr StringView ms_id = "wrap";
 
     struct SplitPos{ ByteCount byte; ColumnCount column; };
+    using SplitPosList = Vector<SplitPos, MemoryDomain::Highlight>;
 
     void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange) override
     {
@@ -620,23 +800,21 @@ struct WrapHighlighter : Highlighter
         const LineCount win_height = context.context.window().dimensions().line;
         const ColumnCount marker_len = zero_if_greater(m_marker.column_length(), wrap_column);
         const Face face_marker = context.context.faces()["WrapMarker"];
+        auto& cache = get_cache(buffer);
         for (auto it = display_buffer.lines().begin();
              it != display_buffer.lines().end(); ++it)
         {
             const LineCount buf_line = it->range().begin.line;
-            const ByteCount line_length = buffer[buf_line].length();
             const ColumnCount indent = m_preserve_indent ?
                 zero_if_greater(line_indent(buffer, tabstop, buf_line), wrap_column) : 0_col;
             const ColumnCount prefix_len = std::max(marker_len, indent);
 
-            auto pos = next_split_pos(buffer, wrap_column, prefix_len, tabstop, buf_line, {0, 0});
-            if (pos.byte == line_length)
-                continue;
-
+            const auto& splits = line_splits(cache, buffer, wrap_column, prefix_len, tabstop, buf_line);
+            auto split_it = splits.begin();
             for (auto atom_it = it->begin();
-                 pos.byte != line_length and atom_it != it->end(); )
+                 split_it != splits.end() and atom_it != it->end(); )
             {
-                const BufferCoord coord{buf_line, pos.byte};
+                const BufferCoord coord{buf_line, split_it->byte};
                 if (!atom_it->has_buffer_range() or
                     coord < atom_it->begin() or coord >= atom_it->end())
                 {
@@ -675,7 +853,7 @@ struct WrapHighlighter : Highlighter
                 }
                 it = display_buffer.lines().insert(it+1, new_line);
 
-                pos = next_split_pos(buffer, wrap_column - prefix_len, prefix_len, tabstop, buf_line, pos);
+                ++split_it;
                 atom_it = it->begin();
             }
         }
@@ -694,19 +872,9 @@ struct WrapHighlighter : Highlighter
         const auto& cursor = context.context.selections().main().cursor();
         const int tabstop = context.context.options()["tabstop"].get<int>();
 
+        auto& cache = get_cache(buffer);
         auto line_wrap_count = [&](LineCount line, ColumnCount prefix_len) {
-            LineCount count = 0;
-            const ByteCount line_length = buffer[line].length();
-            SplitPos pos{0, 0};
-            while (true)
-            {
-                pos = next_split_pos(buffer, wrap_column - (pos.byte == 0 ? 0_col : prefix_len),
-                                     prefix_len, tabstop, line, pos);
-                if (pos.byte == line_length)
-                    break;
-                ++count;
-            }
-            return count;
+            return LineCount{(int)line_splits(cache, buffer, wrap_column, prefix_len, tabstop, line).size()};
         };
 
         const auto win_height = context.context.window().dimensions().line;
@@ -731,22 +899,15 @@ struct WrapHighlighter : Highlighter
 
             if (buf_line == cursor.line)
             {
-                SplitPos pos{0, 0};
-                for (LineCount count = 0; true; ++count)
-                {
-                    auto next_pos = next_split_pos(buffer, wrap_column - (pos.byte != 0 ? prefix_len : 0_col),
-                                                   prefix_len, tabstop, buf_line, pos);
-                    if (next_pos.byte > cursor.column)
-                    {
-                        setup.cursor_pos = DisplayCoord{
-                            win_line + count,
-                            get_column(buffer, tabstop, cursor) -
-                            pos.column + (pos.byte != 0 ? indent : 0_col)
-                        };
-                        break;
-                    }
-                    pos = next_pos;
-                }
+                const auto& splits = line_splits(cache, buffer, wrap_column, prefix_len, tabstop, buf_line);
+                auto next_it = std::upper_bound(splits.begin(), splits.end(), cursor.column,
+                                                [](ByteCount byte, const SplitPos& pos) { return byte < pos.byte; });
+                const SplitPos pos = next_it != splits.begin() ? *(next_it-1) : SplitPos{0, 0};
+                setup.cursor_pos = DisplayCoord{
+                    win_line + (int)(next_it - splits.begin()),
+                    column_from(buffer[buf_line], tabstop, pos, cursor.column) -
+                    pos.column + (pos.byte != 0 ? indent : 0_col)
+                };
             }
             const auto wrap_count = line_wrap_count(buf_line, prefix_len);
             win_line += wrap_count + 1;
@@ -771,11 +932,10 @@ struct WrapHighlighter : Highlighter
         unique_ids.push_back(ms_id);
     }
 
-    SplitPos next_split_pos(const Buffer& buffer,  ColumnCount wrap_column, ColumnCount prefix_len,
-                            int tabstop, LineCount line, SplitPos current) const
+    SplitPos next_split_pos(StringView content, ColumnCount wrap_column, ColumnCount prefix_len,
+                            int tabstop, SplitPos current) const
     {
         const ColumnCount target_column = current.column + wrap_column;
-        StringView content = buffer[line];
 
         SplitPos pos = current;
         SplitPos last_word_boundary = {0, 0};
@@ -846,6 +1006,90 @@ struct WrapHighlighter : Highlighter
         return pos;
     }
 
+    // Split positions only depend on the line content and on the wrapping parameters,
+    // they are cached per line data so that unmodified lines do not get split again.
+    struct LineSplits
+    {
+        StringDataPtr line; // keeps line data alive so that its address identifies its content
+        ColumnCount wrap_column;
+        ColumnCount prefix_len;
+        int tabstop;
+        SplitPosList splits;
+    };
+
+    struct Cache
+    {
+        size_t m_timestamp = -1;
+        HashMap<const StringData*, LineSplits, MemoryDomain::Highlight> m_lines;
+
+        size_t memory_usage() const
+        {
+            size_t res = m_lines.size() * sizeof(decltype(m_lines)::Item);
+            for (auto& [data, entry] : m_lines)
+                res += entry.splits.capacity() * sizeof(SplitPos);
+            return res;
+        }
+    };
+
+    Cache& get_cache(const Buffer& buffer) const
+    {
+        auto& cache = m_cache.get(buffer);
+        if (cache.m_timestamp != buffer.timestamp())
+        {
+            // drop lines that are not referenced anywhere else anymore
+            decltype(cache.m_lines) lines;
+            for (auto& [data, entry] : cache.m_lines)
+            {
+                if (data->refcount > 1)
+                    lines.insert({data, std::move(entry)});
+            }
+            cache.m_lines = std::move(lines);
+            cache.m_timestamp = buffer.timestamp();
+        }
+        return cache;
+    }
+
+    // returns the positions at which line gets split, in increasing order
+    const SplitPosList& line_splits(Cache& cache, const Buffer& buffer, ColumnCount wrap_column,
+                                    ColumnCount prefix_len, int tabstop, LineCount line) const
+    {
+        const StringDataPtr& data = buffer.line_storage(line);
+        auto& entry = cache.m_lines[static_cast<const StringData*>(data.get())];
+        if (entry.line == data and entry.wrap_column == wrap_column and
+            entry.prefix_len == prefix_len and entry.tabstop == tabstop)
+            return entry.splits;
+
+        entry = LineSplits{data, wrap_column, prefix_len, tabstop, {}};
+        const StringView content = data->strview();
+        SplitPos pos{0, 0};
+        while (true)
+        {
+            pos = next_split_pos(content, wrap_column - (pos.byte == 0 ? 0_col : prefix_len),
+                                 prefix_len, tabstop, pos);
+            if (pos.byte == content.length())
+                break;
+            entry.splits.push_back(pos);
+        }
+        return entry.splits;
+    }
+
+    // column of byte in content, counting from the known position pos
+    static ColumnCount column_from(StringView content, int tabstop, SplitPos pos, ByteCount byte)
+    {
+        ColumnCount column = pos.column;
+        for (auto it = content.begin() + (int)pos.byte, end = content.begin() + (int)byte; it < end; )
+        {
+            if (*it == '\t')
+            {
+                column = (column / tabstop + 1) * tabstop;
+                ++it;
+            }
+            else
+                column += codepoint_width(utf8::read_codepoint(it, content.end()));
+        }
+        return column;
+    }
+
     static ColumnCount line_indent(const Buffer& buffer, int tabstop, LineCount line)
     {
         StringView l = buffer[line];
@@ -872,6 +1116,8 @@ struct WrapHighlighter : Highlighter
     const bool m_preserve_indent;
     const ColumnCount m_max_width;
     const String m_marker;
+
+    mutable BufferSideCache<Cache> m_cache;
 };
 
 constexpr StringView WrapHighlighter::ms_id;
@@ -1374,11 +1620,96 @@ void option_update(LineAndSpecList& opt, const Context& context)
     update_line_specs_ifn(context.buffer(), opt);
 }
 
+static bool line_spec_compare(const LineAndSpec& lhs, const LineAndSpec& rhs)
+{
+    return std::get<0>(lhs) < std::get<0>(rhs);
+}
+
 void option_list_postprocess(Vector<LineAndSpec, MemoryDomain::Options>& opt)
 {
-    std::sort(opt.begin(), opt.end(),
-              [](auto& lhs, auto& rhs)
-              { return std::get<0>(lhs) < std::get<0>(rhs); });
+    std::sort(opt.begin(), opt.end(), line_spec_compare);
+}
+
+bool option_add_from_strings(Vector<LineAndSpec, MemoryDomain::Options>& opt, ConstArrayView<String> strs)
+{
+    auto vec = option_from_strings(Meta::Type<Vector<LineAndSpec, MemoryDomain::Options>>{}, strs);
+    if (vec.empty())
+        return false;
+    auto middle = opt.insert(opt.end(),
+                             std::make_move_iterator(vec.begin()),
+                             std::make_move_iterator(vec.end()));
+    std::inplace_merge(opt.begin(), middle, opt.end(), line_spec_compare);
+    return true;
+}
+
+// Map a line of the buffer at the timestamp modifs were computed from to the
+// current buffer, removed lines being mapped to the start of the lines that
+// replaced them, or their end when mapping the end of a span
+static LineCount map_line(ConstArrayView<LineModification> modifs, LineCount line, bool span_end)
+{
+    auto modif_it = std::upper_bound(modifs.begin(), modifs.end(), line,
+                                     [](const LineCount& l, const LineModification& c)
+                                     { return l < c.old_line; });
+    if (modif_it == modifs.begin())
+        return line;
+
+    auto& prev = *(modif_it-1);
+    if (line < prev.old_line + prev.num_removed)
+        return prev.new_line + (span_end ? prev.num_added : 0);
+    return line + prev.diff();
+}
+
+// Replace the elements of the sorted list whose 0 based line, as returned by
+// get_line, is in [first, last] with the ones parsed from strs, which must be
+// in the span. The span and the new elements are given at the timestamp in
+// strs[0], they get updated along with the option to the current buffer.
+template<typename List, typename GetLine, typename Update>
+static bool replace_lines(Buffer& buffer, List& opt, LineCount first, LineCount last,
+                          ConstArrayView<String> strs, GetLine get_line, Update update)
+{
+    if (strs.empty())
+        throw runtime_error("expected a timestamp");
+    const size_t timestamp = option_from_string(Meta::Type<size_t>{}, strs[0]);
+    if (timestamp > buffer.timestamp())
+        throw runtime_error(format("cannot replace lines at timestamp {}, buffer is at timestamp {}",
+                                   timestamp, buffer.timestamp()));
+
+    auto elements = option_from_strings(Meta::Type<List>{}, strs);
+    for (auto& element : elements.list)
+    {
+        if (get_line(element) < first or get_line(element) > last)
+            throw runtime_error(format("'{}' is not within lines {} to {}",
+                                       option_to_string(element, Quoting::Raw), first + 1, last + 1));
+    }
+
+    update(buffer, opt);
+    if (timestamp != buffer.timestamp())
+    {
+        update(buffer, elements);
+        auto modifs = compute_line_modifications(buffer, timestamp);
+        first = map_line(modifs, first, false);
+        last = map_line(modifs, last + 1, true) - 1;
+    }
+
+    auto line_less = [&](const auto& element, LineCount line) { return get_line(element) < line; };
+    auto& list = opt.list;
+    auto span_begin = std::lower_bound(list.begin(), list.end(), first, line_less);
+    auto span_end = std::lower_bound(span_begin, list.end(), last + 1, line_less);
+    if (span_begin == span_end and elements.list.empty())
+        return false;
+
+    auto pos = list.erase(span_begin, span_end);
+    list.insert(pos, std::make_move_iterator(elements.list.begin()), std::make_move_iterator(elements.list.end()));
+    return true;
+}
+
+bool option_replace_lines_from_strings(LineAndSpecList& opt, const Context& context,
+                                       LineCount first, LineCount last, ConstArrayView<String> strs)
+{
+    // line specs are 1 based
+    return replace_lines(context.buffer(), opt, first - 1, last - 1, strs,
+                         [](const LineAndSpec& l) { return std::get<0>(l) - 1; },
+                         update_line_specs_ifn);
 }
 
 const HighlighterDesc flag_lines_desc = {
@@ -1587,10 +1918,80 @@ void option_list_postprocess(Vector<RangeAndString, MemoryDomain::Options>& opt)
     std::sort(opt.begin(), opt.end(), option_element_compare);
 }
 
+void RangeAndStringList::update_max_ends()
+{
+    max_ends.clear();
+    max_ends.reserve(list.size());
+    BufferCoord max_end{-1, -1};
+    for (auto& [range, spec] : list)
+    {
+        max_end = std::max({max_end, range.first, range.last});
+        max_ends.push_back(max_end);
+    }
+}
+
+ArrayView<RangeAndString> RangeAndStringList::ranges_overlapping(BufferCoord begin, BufferCoord end)
+{
+    kak_assert(max_ends.size() == list.size());
+    auto first = list.begin() + (std::lower_bound(max_ends.begin(), max_ends.end(), begin) - max_ends.begin());
+    auto last = std::upper_bound(first, list.end(), end, [](const BufferCoord& coord, const RangeAndString& r) {
+        return coord < std::get<0>(r).first;
+    });
+    return {first, last};
+}
+
+Vector<String> option_to_strings(const RangeAndStringList& opt)
+{
+    return option_to_strings(static_cast<const TimestampedList<RangeAndString>&>(opt));
+}
+
+RangeAndStringList option_from_strings(Meta::Type<RangeAndStringList>, ConstArrayView<String> strs)
+{
+    RangeAndStringList res{option_from_strings(Meta::Type<TimestampedList<RangeAndString>>{}, strs), {}};
+    res.update_max_ends();
+    return res;
+}
+
+static void update_range_specs(Buffer& buffer, RangeAndStringList& opt)
+{
+    if (opt.prefix == buffer.timestamp())
+        return;
+
+    update_ranges(buffer, opt.prefix, opt.list);
+    opt.prefix = buffer.timestamp();
+    opt.update_max_ends();
+}
+
 void option_update(RangeAndStringList& opt, const Context& context)
 {
-    update_ranges(context.buffer(), opt.prefix, opt.list);
-    opt.prefix = context.buffer().timestamp();
+    update_range_specs(context.buffer(), opt);
+}
+
+bool option_add_from_strings(RangeAndStringList& opt, ConstArrayView<String> strs)
+{
+    if (not option_add_from_strings(opt.list, strs))
+        return false;
+    opt.update_max_ends();
+    return true;
+}
+
+bool option_remove_from_strings(RangeAndStringList& opt, ConstArrayView<String> strs)
+{
+    if (not option_remove_from_strings(opt.list, strs))
+        return false;
+    opt.update_max_ends();
+    return true;
+}
+
+bool option_replace_lines_from_strings(RangeAndStringList& opt, const Context& context,
+                                       LineCount first, LineCount last, ConstArrayView<String> strs)
+{
+    if (not replace_lines(context.buffer(), opt, first - 1, last - 1, strs,
+                          [](const RangeAndString& r) { return std::get<0>(r).first.line; },
+                          update_range_specs))
+        return false;
+    opt.update_max_ends();
+    return true;
 }
 
 bool option_add_from_strings(Vector<RangeAndString, MemoryDomain::Options>& opt, ConstArrayView<String> strs)
@@ -1620,10 +2021,9 @@ private:
     {
         auto& buffer = context.context.buffer();
         auto& range_and_faces = get_option(context);
-        update_ranges(buffer, range_and_faces.prefix, range_and_faces.list);
-        range_and_faces.prefix = buffer.timestamp();
+        update_range_specs(buffer, range_and_faces);
 
-        for (auto& [range, face] : range_and_faces.list)
+        for (auto& [range, face] : range_and_faces.ranges_overlapping(display_buffer.range().begin, display_buffer.range().end))
         {
             try
             {
@@ -1665,10 +2065,9 @@ private:
         auto& buffer = context.context.buffer();
         auto& sels = context.context.selections();
         auto& range_and_faces = get_option(context);
-        update_ranges(buffer, range_and_faces.prefix, range_and_faces.list);
-        range_and_faces.prefix = buffer.timestamp();
+        update_range_specs(buffer, range_and_faces);
 
-        for (auto& [range, spec] : range_and_faces.list)
+        for (auto& [range, spec] : range_and_faces.ranges_overlapping(display_buffer.range().begin, display_buffer.range().end))
         {
             try
             {
@@ -1697,8 +2096,7 @@ private:
         auto& sels = context.context.selections();
         auto& range_and_faces = get_option(context);
         const int tabstop = context.context.options()["tabstop"].get<int>();
-        update_ranges(buffer, range_and_faces.prefix, range_and_faces.list);
-        range_and_faces.prefix = buffer.timestamp();
+        update_range_specs(buffer, range_and_faces);
 
         for (auto& [range, spec] : range_and_faces.list)
         {
@@ -1792,7 +2190,38 @@ struct ReferenceHighlighter : Highlighter
         return std::make_unique<ReferenceHighlighter>(passes, parser[0]);
     }
 
+    bool depends_on_buffer_only() const override
+    {
+        static Vector<StringView> checking_refs;
+        if (contains(checking_refs, m_name))
+            return false;
+
+        checking_refs.push_back(m_name);
+        auto pop_name = on_scope_end([] { checking_refs.pop_back(); });
+        auto* target = get_target();
+        return target and target->depends_on_buffer_only();
+    }
+
+    // share cached results with all references to the same highlighter
+    ValueId shared_cache_id() const override
+    {
+        auto* target = get_target();
+        return target ? target->shared_cache_id() : Highlighter::shared_cache_id();
+    }
+
 private:
+    Highlighter* get_target() const
+    {
+        try
+        {
+            return &SharedHighlighters::instance().get_child(m_name);
+        }
+        catch (runtime_error&)
+        {
+            return nullptr;
+        }
+    }
+
     void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange range) override
     {
         static Vector<std::pair<StringView, BufferRange>> running_refs;
@@ -1957,14 +2386,9 @@ public:
         if (m_regions.empty())
             return;
 
-        auto display_range = display_buffer.range();
         const auto& buffer = context.context.buffer();
         auto& regions = get_regions_for_range(buffer, range);
 
-        auto begin = std::lower_bound(regions.begin(), regions.end(), display_range.begin,
-                                      [](const Region& r, BufferCoord c) { return r.end < c; });
-        auto end = std::lower_bound(begin, regions.end(), display_range.end,
-                                    [](const Region& r, BufferCoord c) { return r.begin < c; });
         auto correct = [&](BufferCoord c) -> BufferCoord {
             if (not buffer.is_end(c) and buffer[c.line].length() == c.column)
                 return {c.line+1, 0};
@@ -1974,26 +2398,47 @@ public:
         auto default_region_it = m_regions.find(m_default_region);
         const bool apply_default = default_region_it != m_regions.end();
 
-        auto last_begin = (begin == regions.begin()) ? range.begin : (begin-1)->end;
-        kak_assert(begin <= end);
+        auto& profiler = HighlighterProfiler::instance();
+        ForwardHighlighterApplier applier{display_buffer, context};
+        auto apply_highlighter = [&](BufferCoord begin, BufferCoord end, RegionHighlighter& region) {
+            auto path = profiler.enter(profiler.active() ? region_name(region) : StringView{});
+            applier(begin, end, region);
+        };
 
-        ForwardHighlighterApplier apply_highlighter{display_buffer, context};
-        for (; begin != end; ++begin)
+        const auto displayed = displayed_ranges(context.context, display_buffer);
+        for (auto& display_range : displayed)
         {
-            if (apply_default and last_begin < begin->begin)
-                apply_highlighter(correct(last_begin), correct(begin->begin), *default_region_it->value);
+            auto begin = std::lower_bound(regions.begin(), regions.end(), display_range.begin,
+                                          [](const Region& r, BufferCoord c) { return r.end < c; });
+            auto end = std::lower_bound(begin, regions.end(), display_range.end,
+                                        [](const Region& r, BufferCoord c) { return r.begin < c; });
+
+            auto last_begin = (begin == regions.begin()) ? range.begin : (begin-1)->end;
+            kak_assert(begin <= end);
+
+            for (; begin != end; ++begin)
+            {
+                if (apply_default and last_begin < begin->begin)
+                    apply_highlighter(correct(last_begin), correct(begin->begin), *default_region_it->value);
 
-            apply_highlighter(correct(begin->begin), correct(begin->end), *begin->highlighter);
-            last_begin = begin->end;
+                apply_highlighter(correct(begin->begin), correct(begin->end), *begin->highlighter);
+                last_begin = begin->end;
+            }
+            if (apply_default and last_begin < display_range.end)
+                apply_highlighter(correct(last_begin), &display_range == &displayed.back() ? range.end : correct(display_range.end),
+                                  *default_region_it->value);
         }
-        if (apply_default and last_begin < display_range.end)
-            apply_highlighter(correct(last_begin), range.end, *default_region_it->value);
 
         display_buffer.compute_range();
     }
 
     bool has_children() const override { return true; }
 
+    bool depends_on_buffer_only() const override
+    {
+        return all_of(m_regions, [](auto& region) { return region.value->depends_on_buffer_only(); });
+    }
+
     Highlighter& get_child(StringView path) override
     {
         auto sep_it = find(path, '/');
@@ -2028,6 +2473,7 @@ public:
         else
             m_regions.insert({std::move(name), std::move(region_hl)});
         ++m_regions_timestamp;
+        on_config_changed();
     }
 
     void remove_child(StringView id) override
@@ -2040,6 +2486,7 @@ public:
             throw child_not_found(format("no such id: {}", id));
         m_regions.remove(it);
         ++m_regions_timestamp;
+        on_config_changed();
     }
 
     Completions complete_child(StringView path, ByteCount cursor_pos, bool group) const override
@@ -2166,6 +2613,11 @@ private:
             return m_delegate->fill_unique_ids(unique_ids);
         }
 
+        bool depends_on_buffer_only() const override
+        {
+            return m_delegate->depends_on_buffer_only();
+        }
+
         void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange range) override
         {
             return m_delegate->highlight(context, display_buffer, range);
@@ -2187,6 +2639,12 @@ private:
         bool  m_default = false;
     };
 
+    StringView region_name(const RegionHighlighter& region) const
+    {
+        auto it = find_if(m_regions, [&](auto& item) { return item.value.get() == &region; });
+        return it != m_regions.end() ? StringView{it->key} : StringView{};
+    }
+
     struct Region
     {
         BufferCoord begin;
@@ -2211,6 +2669,18 @@ private:
         LineRangeSet ranges;
         HashMap<RegexKey, RegexMatchList> matches;
         HashMap<BufferRange, RegionList, MemoryDomain::Highlight> regions;
+
+        size_t memory_usage() const
+        {
+            size_t res = (ranges.end() - ranges.begin()) * sizeof(LineRange)
+                       + matches.size() * sizeof(decltype(matches)::Item)
+                       + regions.size() * sizeof(decltype(regions)::Item);
+            for (auto& [key, list] : matches)
+                res += list.capacity() * sizeof(RegexMatch);
+            for (auto& [range, list] : regions)
+                res += list.capacity() * sizeof(Region);
+            return res;
+        }
     };
 
 
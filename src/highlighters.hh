@@ -10,6 +10,11 @@ namespace Kakoune
 
 void register_highlighters();
 
+// Run the colorize pass of highlighter, reusing its result when it only
+// depends on the buffer and was already computed for the same lines
+void highlight_shared(Highlighter& highlighter, HighlightContext context,
+                      DisplayBuffer& display_buffer, BufferRange range);
+
 struct InclusiveBufferRange
 {
     BufferCoord first, last;
@@ -28,17 +33,41 @@ constexpr StringView option_type_name(Meta::Type<LineAndSpecList>)
 }
 void option_update(LineAndSpecList& opt, const Context& context);
 void option_list_postprocess(Vector<LineAndSpec, MemoryDomain::Options>& opt);
+bool option_add_from_strings(Vector<LineAndSpec, MemoryDomain::Options>& opt, ConstArrayView<String> strs);
+bool option_replace_lines_from_strings(LineAndSpecList& opt, const Context& context,
+                                       LineCount first, LineCount last, ConstArrayView<String> strs);
 
 using RangeAndString = std::tuple<InclusiveBufferRange, String>;
-using RangeAndStringList = TimestampedList<RangeAndString>;
+
+// Ranges are kept sorted by their start, along with the furthest end
+// reached by each prefix of the list, so that the ranges around a buffer
+// span are found with binary searches.
+struct RangeAndStringList : TimestampedList<RangeAndString>
+{
+    Vector<BufferCoord, MemoryDomain::Options> max_ends;
+
+    void update_max_ends();
+    ArrayView<RangeAndString> ranges_overlapping(BufferCoord begin, BufferCoord end);
+
+    friend bool operator==(const RangeAndStringList& lhs, const RangeAndStringList& rhs)
+    {
+        return lhs.prefix == rhs.prefix and lhs.list == rhs.list;
+    }
+};
 
 constexpr StringView option_type_name(Meta::Type<RangeAndStringList>)
 {
     return "range-specs";
 }
+Vector<String> option_to_strings(const RangeAndStringList& opt);
+RangeAndStringList option_from_strings(Meta::Type<RangeAndStringList>, ConstArrayView<String> strs);
 void option_update(RangeAndStringList& opt, const Context& context);
 void option_list_postprocess(Vector<RangeAndString, MemoryDomain::Options>& opt);
 bool option_add_from_strings(Vector<RangeAndString, MemoryDomain::Options>& opt, ConstArrayView<String> strs);
+bool option_add_from_strings(RangeAndStringList& opt, ConstArrayView<String> strs);
+bool option_remove_from_strings(RangeAndStringList& opt, ConstArrayView<String> strs);
+bool option_replace_lines_from_strings(RangeAndStringList& opt, const Context& context,
+                                       LineCount first, LineCount last, ConstArrayView<String> strs);
 
 }
 
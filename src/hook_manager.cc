@@ -10,28 +10,164 @@
 #include "profile.hh"
 #include "ranges.hh"
 #include "regex.hh"
+#include "utf8.hh"
 
 namespace Kakoune
 {
 
+namespace
+{
+
+enum class FilterKind
+{
+    Regex,
+    Prefix,
+    Exact,
+    Any
+};
+
+// Extract the literal text every param matching filter must start with, or
+// be equal to, so that most hooks can be rejected without running their regex
+std::pair<FilterKind, String> analyze_filter(StringView filter)
+{
+    if (filter == ".*")
+        return {FilterKind::Any, {}};
+
+    // A top level alternation allows for matches not starting with the prefix
+    int depth = 0;
+    for (auto it = filter.begin(); it != filter.end(); ++it)
+    {
+        if (*it == '\\')
+        {
+            if (++it == filter.end() or *it == 'Q')
+                return {FilterKind::Regex, {}};
+        }
+        else if (*it == '[')
+        {
+            while (++it != filter.end() and *it != ']')
+            {
+                if (*it == '\\' and ++it == filter.end())
+                    return {FilterKind::Regex, {}};
+            }
+            if (it == filter.end())
+                return {FilterKind::Regex, {}};
+        }
+        else if (*it == '(')
+            ++depth;
+        else if (*it == ')' and --depth < 0)
+            return {FilterKind::Regex, {}};
+        else if (*it == '|' and depth == 0)
+            return {FilterKind::Regex, {}};
+    }
+
+    String literal;
+    auto it = filter.begin();
+    while (it != filter.end())
+    {
+        auto next = it;
+        Codepoint cp = utf8::read_codepoint(next, filter.end());
+        if (cp == '\\')
+        {
+            if (next == filter.end())
+                break;
+            cp = utf8::read_codepoint(next, filter.end());
+            if (cp == 'n')
+                cp = '\n';
+            else if (cp == 't')
+                cp = '\t';
+            else if (cp == 'r')
+                cp = '\r';
+            else if (not contains("^$\\.*+?()[]{}|", cp))
+                break;
+        }
+        else if (contains("^$.*+?()[]{}|", cp))
+            break;
+
+        // the last literal is optional or repeated when followed by a quantifier
+        if (next != filter.end() and contains("*+?{", *next))
+            break;
+
+        literal += String{cp};
+        it = next;
+    }
+
+    if (it == filter.end())
+        return {FilterKind::Exact, std::move(literal)};
+    if (not literal.empty())
+        return {FilterKind::Prefix, std::move(literal)};
+    return {FilterKind::Regex, {}};
+}
+
+}
+
 struct HookManager::HookData
 {
+    HookData(String group, HookFlags flags, Regex filter, String commands)
+        : group{std::move(group)}, flags{flags}, filter{std::move(filter)}, commands{std::move(commands)}
+    {
+        std::tie(filter_kind, filter_literal) = analyze_filter(this->filter.str());
+    }
+
     String group;
     HookFlags flags;
     Regex filter;
     String commands;
 
+    FilterKind filter_kind;
+    String filter_literal;
+
+    size_t rejected_count = 0;
+    size_t regex_count = 0;
+    size_t run_count = 0;
+    std::chrono::microseconds run_time{};
+
+    bool filter_matches(StringView param, MatchResults<const char*>& captures)
+    {
+        switch (filter_kind)
+        {
+            case FilterKind::Exact:
+                if (param != filter_literal)
+                {
+                    ++rejected_count;
+                    return false;
+                }
+                [[fallthrough]];
+            case FilterKind::Any:
+                captures.values().clear();
+                captures.values().push_back(param.begin());
+                captures.values().push_back(param.end());
+                return true;
+            case FilterKind::Prefix:
+                if (not param.starts_with(filter_literal))
+                {
+                    ++rejected_count;
+                    return false;
+                }
+                [[fallthrough]];
+            case FilterKind::Regex:
+                ++regex_count;
+                return regex_match(param.begin(), param.end(), captures, filter);
+        }
+        kak_assert(false);
+        return false;
+    }
+
     bool should_run(bool only_always, const Regex& disabled_hooks, StringView param,
-                    MatchResults<const char*>& captures) const
+                    MatchResults<const char*>& captures)
     {
         return (not only_always or (flags & HookFlags::Always)) and
                 (group.empty() or disabled_hooks.empty() or
                  not regex_match(group.begin(), group.end(), disabled_hooks))
-                and regex_match(param.begin(), param.end(), captures, filter);
+                and filter_matches(param, captures);
     }
 
     void exec(Hook hook, StringView param, Context& context, const MatchResults<const char*>& captures)
     {
+        ++run_count;
+        ProfileScope profile{context, [&](std::chrono::microseconds duration) {
+            run_time += duration;
+        }};
+
         if (context.options()["debug"].get<DebugFlags>() & DebugFlags::Hooks)
             write_to_debug_buffer(format("hook {}({})/{}",
                                   enum_desc(Meta::Type<Hook>{})[to_underlying(hook)].name,
@@ -58,7 +194,7 @@ HookManager::~HookManager() = default;
 
 void HookManager::add_hook(Hook hook, String group, HookFlags flags, Regex filter, String commands, Context& context)
 {
-    std::unique_ptr<HookData> hook_data{new HookData{std::move(group), flags, std::move(filter), std::move(commands)}};
+    auto hook_data = std::make_unique<HookData>(std::move(group), flags, std::move(filter), std::move(commands));
     if (hook == Hook::ModuleLoaded)
     {
         const bool only_always = context.hooks_disabled();
@@ -106,6 +242,19 @@ CandidateList HookManager::complete_hook_group(StringView prefix, ByteCount pos_
     return res;
 }
 
+void HookManager::debug_stats(StringView scope) const
+{
+    for (size_t hook = 0; hook < m_hooks.size(); ++hook)
+    {
+        auto hook_name = enum_desc(Meta::Type<Hook>{})[hook].name;
+        for (auto& data : m_hooks[hook])
+            write_to_debug_buffer(format("{:12} │{:12} │{:12} │{:12} │ {} {} {}/{}",
+                                         grouped(data->run_count), grouped(data->regex_count),
+                                         grouped(data->rejected_count), grouped(data->run_time.count()),
+                                         scope, hook_name, data->filter.str(), data->group));
+    }
+}
+
 void HookManager::run_hook(Hook hook, StringView param, Context& context)
 {
     const bool only_always = context.hooks_disabled();
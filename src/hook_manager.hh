@@ -133,6 +133,9 @@ public:
     CandidateList complete_hook_group(StringView prefix, ByteCount pos_in_token);
     void run_hook(Hook hook, StringView param, Context& context);
 
+    // write each hook run count, filter checks and run time to the debug buffer
+    void debug_stats(StringView scope) const;
+
 private:
     struct HookData;
 
@@ -155,6 +155,158 @@ JsonResult parse_json_impl(const char* pos, const char* end, size_t depth)
 JsonResult parse_json(const char* pos, const char* end) { return parse_json_impl(pos,          end,        0); }
 JsonResult parse_json(StringView json)                  { return parse_json_impl(json.begin(), json.end(), 0); }
 
+static Optional<int> hex_digit(char c)
+{
+    if (c >= '0' and c <= '9')
+        return c - '0';
+    if (c >= 'a' and c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' and c <= 'F')
+        return c - 'A' + 10;
+    return {};
+}
+
+static bool is_literal_char(char c) { return c >= 'a' and c <= 'z'; }
+
+Optional<JsonToken> JsonTokenizer::next(const char*& pos, const char* end)
+{
+    while (pos != end)
+    {
+        const char c = *pos;
+        switch (m_state)
+        {
+        case State::None:
+            ++pos;
+            switch (c)
+            {
+                case '{': return JsonToken{JsonToken::Type::BeginObject};
+                case '}': return JsonToken{JsonToken::Type::EndObject};
+                case '[': return JsonToken{JsonToken::Type::BeginArray};
+                case ']': return JsonToken{JsonToken::Type::EndArray};
+                case ':': return JsonToken{JsonToken::Type::Colon};
+                case ',': return JsonToken{JsonToken::Type::Comma};
+                case '"':
+                    m_content.clear();
+                    m_state = State::String;
+                    break;
+                default:
+                    if (is_digit(c) or c == '-')
+                        m_state = State::Number;
+                    else if (is_literal_char(c))
+                        m_state = State::Literal;
+                    else if (is_blank(c) or c == '\r')
+                        break;
+                    else
+                        throw runtime_error("unable to parse json");
+                    m_content.clear();
+                    m_content += c;
+            }
+            break;
+
+        case State::String:
+        {
+            auto string_end = std::find_if(pos, end, [](char c) { return c == '"' or c == '\\'; });
+            m_content += StringView{pos, string_end};
+            pos = string_end;
+            if (pos == end)
+                break;
+            m_state = *pos++ == '"' ? State::None : State::Escape;
+            if (m_state == State::None)
+                return JsonToken{JsonToken::Type::String, m_content};
+            break;
+        }
+
+        case State::Escape:
+            ++pos;
+            m_state = State::String;
+            switch (c)
+            {
+                case 'b': m_content += '\b'; break;
+                case 'f': m_content += '\f'; break;
+                case 'n': m_content += '\n'; break;
+                case 'r': m_content += '\r'; break;
+                case 't': m_content += '\t'; break;
+                case 'u':
+                    m_state = State::Unicode;
+                    m_unicode = 0;
+                    m_unicode_digits = 0;
+                    break;
+                default: m_content += c; break;
+            }
+            break;
+
+        case State::Unicode:
+        {
+            ++pos;
+            auto digit = hex_digit(c);
+            if (not digit)
+                throw runtime_error("invalid unicode escape in json string");
+            m_unicode = m_unicode * 16 + *digit;
+            if (++m_unicode_digits < 4)
+                break;
+
+            m_state = State::String;
+            if (m_unicode >= 0xD800 and m_unicode < 0xDC00)
+                m_high_surrogate = m_unicode;
+            else if (m_unicode >= 0xDC00 and m_unicode < 0xE000 and m_high_surrogate != 0)
+            {
+                m_content += String{0x10000 + ((m_high_surrogate - 0xD800) << 10) + (m_unicode - 0xDC00)};
+                m_high_surrogate = 0;
+            }
+            else
+                m_content += String{m_unicode};
+            break;
+        }
+
+        case State::Number:
+        {
+            auto number_end = std::find_if_not(pos, end, is_digit);
+            m_content += StringView{pos, number_end};
+            pos = number_end;
+            if (pos != end)
+                return finish_number();
+            break;
+        }
+
+        case State::Literal:
+        {
+            auto literal_end = std::find_if_not(pos, end, is_literal_char);
+            m_content += StringView{pos, literal_end};
+            pos = literal_end;
+            if (pos != end)
+                return finish_literal();
+            break;
+        }
+        }
+    }
+    return {};
+}
+
+Optional<JsonToken> JsonTokenizer::finish_number()
+{
+    m_state = State::None;
+    return JsonToken{JsonToken::Type::Integer, {}, str_to_int(m_content)};
+}
+
+Optional<JsonToken> JsonTokenizer::finish_literal()
+{
+    m_state = State::None;
+    if (m_content == "true")
+        return JsonToken{JsonToken::Type::True};
+    if (m_content == "false")
+        return JsonToken{JsonToken::Type::False};
+    if (m_content == "null")
+        return JsonToken{JsonToken::Type::Null};
+    throw runtime_error("unable to parse json");
+}
+
+void JsonTokenizer::reset()
+{
+    m_state = State::None;
+    m_content.clear();
+    m_high_surrogate = 0;
+}
+
 UnitTest test_json_parser{[]()
 {
     {
@@ -190,6 +342,42 @@ UnitTest test_json_parser{[]()
     }
 }};
 
+UnitTest test_json_tokenizer{[]()
+{
+    auto tokenize = [](std::initializer_list<StringView> chunks) {
+        JsonTokenizer tokenizer;
+        String res;
+        for (auto chunk : chunks)
+        {
+            const char* pos = chunk.begin();
+            while (auto token = tokenizer.next(pos, chunk.end()))
+            {
+                switch (token->type)
+                {
+                    case JsonToken::Type::String: res += format("s({})", token->string); break;
+                    case JsonToken::Type::Integer: res += format("i({})", token->integer); break;
+                    case JsonToken::Type::True: res += "true"; break;
+                    case JsonToken::Type::False: res += "false"; break;
+                    case JsonToken::Type::Null: res += "null"; break;
+                    default: res += "{}[]:,"[(int)token->type]; break;
+                }
+            }
+        }
+        return res;
+    };
+
+    kak_assert(tokenize({R"({ "method": "keys", "params": [ "a", -12 ] })"}) ==
+               "{s(method):s(keys),s(params):[s(a),i(-12)]}");
+    // tokens split across chunks
+    kak_assert(tokenize({R"({"met)", R"(hod": [tr)", R"(ue, 1)", R"(23, "a\)", R"("b\u00)", R"(e9"]})"}) ==
+               "{s(method):[true,i(123),s(a\"bé)]}");
+    kak_assert(tokenize({R"(["\n\ud83d)", R"(\ude00", null, false])"}) == "[s(\n😀),null,false]");
+    // number at the end of data is incomplete
+    kak_assert(tokenize({"[12", "3"}) == "[");
+    kak_expect_throw(runtime_error, tokenize({"[tru]"}));
+    kak_expect_throw(runtime_error, tokenize({"[\"\\uzz\"]"}));
+}};
+
 UnitTest test_to_json{[]()
 {
     kak_assert(to_json(true) == "true");
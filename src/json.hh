@@ -2,6 +2,7 @@
 #define json_hh_INCLUDED
 
 #include "hash_map.hh"
+#include "optional.hh"
 #include "string.hh"
 #include "string_utils.hh"
 #include "value.hh"
@@ -37,6 +38,53 @@ struct JsonResult { Value value; const char* new_pos; };
 JsonResult parse_json(const char* pos, const char* end);
 JsonResult parse_json(StringView json);
 
+struct JsonToken
+{
+    enum class Type
+    {
+        BeginObject,
+        EndObject,
+        BeginArray,
+        EndArray,
+        Colon,
+        Comma,
+        String,
+        Integer,
+        True,
+        False,
+        Null
+    };
+
+    Type type;
+    StringView string = {}; // unescaped content of String tokens, valid until next call
+    int integer = 0;
+};
+
+// Incremental json tokenizer, data can be given in arbitrary chunks, partial
+// tokens at the end of a chunk are kept until the next one completes them.
+class JsonTokenizer
+{
+public:
+    // return the next token in [pos, end), advancing pos, or nothing if
+    // more data is needed, in which case pos is moved to end.
+    Optional<JsonToken> next(const char*& pos, const char* end);
+
+    // discard partial token
+    void reset();
+
+private:
+    enum class State { None, String, Escape, Unicode, Number, Literal };
+
+    Optional<JsonToken> finish_number();
+    Optional<JsonToken> finish_literal();
+
+    State m_state = State::None;
+    String m_content;
+    Codepoint m_unicode = 0;       // \u escape being parsed
+    int m_unicode_digits = 0;
+    Codepoint m_high_surrogate = 0;
+};
+
 }
 
 #endif // json_hh_INCLUDED
@@ -9,6 +9,7 @@
 #include "ranges.hh"
 #include "string_utils.hh"
 #include "format.hh"
+#include "hash_map.hh"
 
 #include <cstdio>
 #include <utility>
@@ -58,12 +59,33 @@ String to_json(Attribute attributes)
                       ',', false) + "]";
 }
 
-String to_json(Face face)
+static String face_definition(Face face)
 {
     return format(R"(\{ "fg": {}, "bg": {}, "underline": {}, "attributes": {} })",
                   to_json(face.fg), to_json(face.bg), to_json(face.underline), to_json(face.attributes));
 }
 
+int FaceTable::id(Face face)
+{
+    if (auto it = ids.find(face); it != ids.end())
+        return it->value;
+    const int id = ids.size();
+    ids.insert({face, id});
+    new_faces.push_back(face);
+    return id;
+}
+
+// face table of the request being converted, if any, as faces are
+// converted through to_json which has no other way to reach it.
+static FaceTable* converting_face_table = nullptr;
+
+String to_json(Face face)
+{
+    if (converting_face_table)
+        return to_json(converting_face_table->id(face));
+    return face_definition(face);
+}
+
 String to_json(const DisplayAtom& atom)
 {
     return format(R"(\{ "face": {}, "contents": {} })", to_json(atom.face), to_json(atom.content()));
@@ -122,25 +144,58 @@ String concat()
 template<typename First, typename... Args>
 String concat(First&& first, Args&&... args)
 {
+    // ensure parameters are converted in order, as face ids are assigned on conversion
+    String res = to_json(first);
     if (sizeof...(Args) != 0)
-        return to_json(first) + ", " + concat(args...);
-    return to_json(first);
+        res += ", " + concat(args...);
+    return res;
+}
+
+template<typename... Args>
+String rpc_request(FaceTable* face_table, StringView method, Args&&... args)
+{
+    if (face_table and face_table->ids.size() >= FaceTable::max_size)
+        face_table->ids.clear();
+
+    auto previous_table = std::exchange(converting_face_table, face_table);
+    auto restore_table = on_scope_end([&] { converting_face_table = previous_table; });
+    auto params = concat(std::forward<Args>(args)...);
+
+    // faces referenced by params need to be defined first, a first id of
+    // zero tells the client to discard its previous face table.
+    String request;
+    if (face_table and not face_table->new_faces.empty())
+    {
+        auto& new_faces = face_table->new_faces;
+        request = format(R"(\{ "jsonrpc": "2.0", "method": "define_faces", "params": [{}, [{}]] }{})",
+                         face_table->ids.size() - new_faces.size(),
+                         join(new_faces | transform(face_definition), ", "), "\n");
+        new_faces.clear();
+    }
+
+    request += format(R"(\{ "jsonrpc": "2.0", "method": "{}", "params": [{}] }{})",
+                      method, params, "\n");
+    return request;
 }
 
 template<typename... Args>
-void rpc_call(StringView method, Args&&... args)
+void JsonUI::rpc_call(StringView method, Args&&... args)
 {
-    auto q = format(R"(\{ "jsonrpc": "2.0", "method": "{}", "params": [{}] }{})",
-                    method, concat(std::forward<Args>(args)...), "\n");
+    write(1, rpc_request(m_face_table ? &*m_face_table : nullptr, method, std::forward<Args>(args)...));
+}
 
-    write(1, q);
+String json_draw_request(const DisplayBuffer& display_buffer,
+                         const Face& default_face, const Face& padding_face)
+{
+    // faces are defined inline, as without a face table
+    return rpc_request(nullptr, "draw", display_buffer.lines(), default_face, padding_face);
 }
 
 JsonUI::JsonUI()
     : m_stdin_watcher{0, FdEvents::Read, EventMode::Urgent,
                       [this](FDWatcher&, FdEvents, EventMode mode) {
         parse_requests(mode);
-      }}, m_dimensions{24, 80}
+      }}, m_dimensions{24, 80}, m_input_pos{0}
 {
     set_signal_handler(SIGINT, SIG_DFL);
 }
@@ -218,42 +273,174 @@ void JsonUI::set_on_paste(OnPasteCallback callback)
     m_on_paste = std::move(callback);
 }
 
-void JsonUI::eval_json(const Value& json)
+void JsonUI::handle_token(const JsonToken& token)
 {
-    if (not json.is_a<JsonObject>())
-        throw invalid_rpc_request("request is not an object");
+    using Type = JsonToken::Type;
+    using Expect = Request::Expect;
+    using Field = Request::Field;
+    auto& req = m_request;
 
-    const JsonObject& object = json.as<JsonObject>();
-    auto json_it = object.find("jsonrpc"_sv);
-    if (json_it == object.end() or
-        not json_it->value.is_a<String>() or
-        json_it->value.as<String>() != "2.0")
-        throw invalid_rpc_request("only protocol '2.0' is supported");
-    else if (not json_it->value.is_a<String>())
-        throw invalid_rpc_request("'jsonrpc' is not a string");
+    const bool begin = token.type == Type::BeginObject or token.type == Type::BeginArray;
+    const bool end = token.type == Type::EndObject or token.type == Type::EndArray;
 
-    auto method_it = object.find("method"_sv);
-    if (method_it == object.end())
-        throw invalid_rpc_request("method missing");
-    else if (not method_it->value.is_a<String>())
-        throw invalid_rpc_request("'method' is not a string");
-    StringView method = method_it->value.as<String>();
+    // skipping the value of an unknown field, or an unsupported param
+    if (req.skip_depth > 0)
+    {
+        if (begin)
+            ++req.skip_depth;
+        else if (end and --req.skip_depth == 0)
+            req.expect = Expect::Separator;
+        return;
+    }
 
-    auto params_it = object.find("params"_sv);
-    if (params_it == object.end())
+    switch (req.expect)
+    {
+    case Expect::Value:
+        if (req.depth == 0)
+        {
+            if (token.type != Type::BeginObject)
+                throw invalid_rpc_request("request is not an object");
+            req.depth = 1;
+            req.expect = Expect::Key;
+            req.valid_version = false;
+            req.has_params = false;
+            req.method.clear();
+            req.param_count = 0;
+        }
+        else if (req.depth == 1)
+        {
+            req.expect = Expect::Separator;
+            switch (req.field)
+            {
+            case Field::JsonRpc:
+                if (token.type != Type::String or token.string != "2.0")
+                    throw invalid_rpc_request("only protocol '2.0' is supported");
+                req.valid_version = true;
+                break;
+            case Field::Method:
+                if (token.type != Type::String)
+                    throw invalid_rpc_request("'method' is not a string");
+                req.method = token.string.str();
+                break;
+            case Field::Params:
+                if (token.type != Type::BeginArray)
+                    throw invalid_rpc_request("'params' is not an array");
+                req.has_params = true;
+                req.depth = 2;
+                req.expect = Expect::Value;
+                break;
+            case Field::Other:
+                if (begin)
+                    req.skip_depth = 1;
+                else if (end)
+                    throw runtime_error("unable to parse object");
+                break;
+            }
+        }
+        else
+        {
+            if (token.type == Type::EndArray and req.param_count == 0)
+            {
+                req.depth = 1;
+                req.expect = Expect::Separator;
+                break;
+            }
+            if (end)
+                throw runtime_error("unable to parse array");
+
+            if (req.param_count == req.params.size())
+                req.params.emplace_back();
+            auto& param = req.params[req.param_count++];
+            switch (token.type)
+            {
+                case Type::Integer: param.type = Param::Type::Integer; param.integer = token.integer; break;
+                case Type::True: param.type = Param::Type::Bool; param.integer = 1; break;
+                case Type::False: param.type = Param::Type::Bool; param.integer = 0; break;
+                case Type::String: param.type = Param::Type::String; param.string = token.string.str(); break;
+                default: param.type = Param::Type::Other; break;
+            }
+            if (begin)
+                req.skip_depth = 1;
+            else
+                req.expect = Expect::Separator;
+        }
+        break;
+
+    case Expect::Key:
+        if (token.type == Type::EndObject)
+            return end_request();
+        if (token.type != Type::String)
+            throw runtime_error("unable to parse object, expected a field name");
+        req.field = token.string == "jsonrpc" ? Field::JsonRpc
+                  : token.string == "method"  ? Field::Method
+                  : token.string == "params"  ? Field::Params : Field::Other;
+        req.expect = Expect::Colon;
+        break;
+
+    case Expect::Colon:
+        if (token.type != Type::Colon)
+            throw runtime_error("expected :");
+        req.expect = Expect::Value;
+        break;
+
+    case Expect::Separator:
+        if (token.type == Type::Comma)
+            req.expect = req.depth == 1 ? Expect::Key : Expect::Value;
+        else if (req.depth == 1 and token.type == Type::EndObject)
+            end_request();
+        else if (req.depth == 2 and token.type == Type::EndArray)
+        {
+            req.depth = 1;
+            req.expect = Expect::Separator;
+        }
+        else if (req.depth == 1)
+            throw runtime_error("unable to parse object, expected ',' or '}'");
+        else
+            throw runtime_error("unable to parse array, expected ',' or ']'");
+        break;
+    }
+}
+
+void JsonUI::end_request()
+{
+    m_request.depth = 0;
+    m_request.expect = Request::Expect::Value;
+    try
+    {
+        eval_request();
+    }
+    catch (runtime_error& error)
+    {
+        write(2, format("error while handling requests: '{}'\n", error.what()));
+    }
+}
+
+void JsonUI::eval_request()
+{
+    const auto& req = m_request;
+    if (not req.valid_version)
+        throw invalid_rpc_request("only protocol '2.0' is supported");
+    if (req.method.empty())
+        throw invalid_rpc_request("method missing");
+    if (not req.has_params)
         throw invalid_rpc_request("params missing");
-    else if (not params_it->value.is_a<JsonArray>())
-        throw invalid_rpc_request("'params' is not an array");
-    const JsonArray& params = params_it->value.as<JsonArray>();
+
+    StringView method = req.method;
+    ConstArrayView<Param> params{req.params.data(), req.param_count};
+    auto is = [&](size_t index, Param::Type type) { return params[index].type == type; };
+    auto are_ints = [&](size_t begin) {
+        return std::all_of(params.begin() + begin, params.end(),
+                           [](const Param& param) { return param.type == Param::Type::Integer; });
+    };
 
     if (method == "keys")
     {
         for (auto& key_val : params)
         {
-            if (not key_val.is_a<String>())
+            if (key_val.type != Param::Type::String)
                 throw invalid_rpc_request("'keys' is not an array of strings");
 
-            for (auto& key : parse_keys(key_val.as<String>()))
+            for (auto& key : parse_keys(key_val.string))
                 m_on_key(key);
         }
     }
@@ -262,53 +449,62 @@ void JsonUI::eval_json(const Value& json)
         if (params.size() != 2)
             throw invalid_rpc_request("mouse coordinates not specified");
 
-        if (not params[0].is_a<int>() or not params[1].is_a<int>())
+        if (not are_ints(0))
             throw invalid_rpc_request("mouse coordinates are not integers");
 
-        m_on_key({Key::Modifiers::MousePos, encode_coord({params[0].as<int>(), params[1].as<int>()})});
+        m_on_key({Key::Modifiers::MousePos, encode_coord({params[0].integer, params[1].integer})});
     }
     else if (method == "mouse_press" or method == "mouse_release")
     {
         if (params.size() != 3)
             throw invalid_rpc_request("mouse button/coordinates not specified");
 
-        if (not params[0].is_a<String>())
+        if (not is(0, Param::Type::String))
             throw invalid_rpc_request("mouse button is not a string");
-        if (not params[1].is_a<int>() or not params[2].is_a<int>())
+        if (not are_ints(1))
             throw invalid_rpc_request("mouse coordinates are not integers");
 
         auto event = method == "mouse_press" ? Key::Modifiers::MousePress : Key::Modifiers::MouseRelease;
-        auto button = str_to_button(params[0].as<String>());
+        auto button = str_to_button(params[0].string);
 
-        m_on_key({event | Key::to_modifier(button), encode_coord({params[1].as<int>(), params[2].as<int>()})});
+        m_on_key({event | Key::to_modifier(button), encode_coord({params[1].integer, params[2].integer})});
     }
     else if (method == "scroll")
     {
         if (params.size() != 3)
             throw invalid_rpc_request("scroll needs an amount and coordinates");
-        else if (not params[0].is_a<int>() or not params[1].is_a<int>() or not params[2].is_a<int>())
+        else if (not are_ints(0))
             throw invalid_rpc_request("scroll parameters are not integers");
-        m_on_key({Key::Modifiers::Scroll | (Key::Modifiers)(params[0].as<int>() << 16),
-                  encode_coord({params[1].as<int>(), params[2].as<int>()})});
+        m_on_key({Key::Modifiers::Scroll | (Key::Modifiers)(params[0].integer << 16),
+                  encode_coord({params[1].integer, params[2].integer})});
     }
     else if (method == "menu_select")
     {
         if (params.size() != 1)
             throw invalid_rpc_request("menu_select needs the item index");
-        else if (not params[0].is_a<int>())
+        else if (not is(0, Param::Type::Integer))
             throw invalid_rpc_request("menu index is not an integer");
 
-        m_on_key({Key::Modifiers::MenuSelect, (Codepoint)params[0].as<int>()});
+        m_on_key({Key::Modifiers::MenuSelect, (Codepoint)params[0].integer});
+    }
+    else if (method == "face_table")
+    {
+        if (params.size() != 1 or not is(0, Param::Type::Bool))
+            throw invalid_rpc_request("face_table expects a boolean");
+
+        if (not params[0].integer)
+            m_face_table.reset();
+        else if (not m_face_table)
+            m_face_table.emplace();
     }
     else if (method == "resize")
     {
         if (params.size() != 2)
             throw runtime_error("resize expects 2 parameters");
-        else if (not params[0].is_a<int>() or
-                 not params[1].is_a<int>())
+        else if (not are_ints(0))
             throw invalid_rpc_request("width and height are not integers");
 
-        DisplayCoord dim{params[0].as<int>(), params[1].as<int>()};
+        DisplayCoord dim{params[0].integer, params[1].integer};
         m_dimensions = dim;
         m_on_key(resize(dim));
     }
@@ -318,44 +514,54 @@ void JsonUI::eval_json(const Value& json)
 
 void JsonUI::parse_requests(EventMode mode)
 {
-    constexpr size_t bufsize = 1024;
-    char buf[bufsize];
-    while (fd_readable(0))
+    if (not m_on_key)
+        return;
+
+    while (true)
     {
-        ssize_t size = ::read(0, buf, bufsize);
-        if (size == -1 or size == 0)
+        if (m_input_pos == m_input.length())
         {
-            m_stdin_watcher.close_fd();
-            break;
+            if (not fd_readable(0))
+                break;
+
+            constexpr size_t bufsize = 1024;
+            char buf[bufsize];
+            ssize_t size = ::read(0, buf, bufsize);
+            if (size == -1 or size == 0)
+            {
+                m_stdin_watcher.close_fd();
+                break;
+            }
+            m_input = String{buf, buf + size};
+            m_input_pos = 0;
         }
 
-        m_requests += StringView{buf, buf + size};
-    }
-
-    if (not m_on_key)
-        return;
+        const char* pos = m_input.begin() + (int)m_input_pos;
+        if (m_skip_line)
+        {
+            const char* end = m_input.end();
+            auto eol = std::find(pos, end, '\n');
+            m_skip_line = eol == end;
+            m_input_pos = (eol == end ? end : eol + 1) - m_input.begin();
+            continue;
+        }
 
-    while (not m_requests.empty())
-    {
-        const char* pos = nullptr;
         try
         {
-            auto [json, new_pos] = parse_json(m_requests);
-            pos = new_pos;
-            if (json)
-                eval_json(json);
+            auto token = m_tokenizer.next(pos, m_input.end());
+            m_input_pos = pos - m_input.begin();
+            if (token)
+                handle_token(*token);
         }
         catch (runtime_error& error)
         {
-            write(2, format("error while handling requests '{}': '{}'\n",
-                            m_requests, error.what()));
-            // try to salvage request by dropping its first line
-            pos = std::min(m_requests.end(), find(m_requests, '\n')+1);
+            write(2, format("error while handling requests: '{}'\n", error.what()));
+            // try to salvage following requests by dropping the rest of the line
+            m_input_pos = pos - m_input.begin();
+            m_tokenizer.reset();
+            m_request = Request{};
+            m_skip_line = true;
         }
-        if (not pos)
-            break; // unterminated request ?
-
-        m_requests = String{pos, m_requests.end()};
     }
 }
 
@@ -4,12 +4,26 @@
 #include "user_interface.hh"
 #include "event_manager.hh"
 #include "coord.hh"
+#include "face.hh"
+#include "hash_map.hh"
+#include "json.hh"
+#include "optional.hh"
 #include "string.hh"
 
 namespace Kakoune
 {
 
-struct Value;
+// When enabled by the client, faces are sent as integer ids, new faces
+// get defined by a define_faces request before being referenced.
+struct FaceTable
+{
+    static constexpr size_t max_size = 4096;
+
+    int id(Face face);
+
+    HashMap<Face, int, MemoryDomain::Faces> ids;
+    Vector<Face, MemoryDomain::Faces> new_faces;
+};
 
 class JsonUI : public UserInterface
 {
@@ -51,16 +65,56 @@ public:
 
 private:
     void parse_requests(EventMode mode);
-    void eval_json(const Value& value);
+    void handle_token(const JsonToken& token);
+    void end_request();
+    void eval_request();
+
+    template<typename... Args>
+    void rpc_call(StringView method, Args&&... args);
 
     FDWatcher m_stdin_watcher;
     OnKeyCallback m_on_key;
     OnPasteCallback m_on_paste;
     Vector<Key, MemoryDomain::Client> m_pending_keys;
     DisplayCoord m_dimensions;
-    String m_requests;
+    Optional<FaceTable> m_face_table;
+
+    String m_input;          // last data read from stdin
+    ByteCount m_input_pos;   // start of the data not yet tokenized
+    bool m_skip_line = false; // skip the rest of an invalid request
+    JsonTokenizer m_tokenizer;
+
+    // Requests are decoded token by token, the params of the supported
+    // methods all being scalars, they are stored directly as typed values.
+    struct Param
+    {
+        enum class Type { Integer, Bool, String, Other };
+        Type type;
+        int integer;
+        String string;
+    };
+
+    struct Request
+    {
+        enum class Expect { Value, Key, Colon, Separator };
+        enum class Field { JsonRpc, Method, Params, Other };
+
+        Expect expect = Expect::Value;
+        int depth = 0;        // 0 outside of requests, 1 in the request object, 2 in params
+        int skip_depth = 0;   // nesting depth in a skipped value
+        Field field = Field::Other;
+        bool valid_version = false;
+        bool has_params = false;
+        String method;
+        Vector<Param, MemoryDomain::Client> params; // only the first param_count ones are used,
+        size_t param_count = 0;                     // the other ones are kept for their capacity
+    } m_request;
 };
 
+// encode a draw request as the json ui would, used for profiling
+String json_draw_request(const DisplayBuffer& display_buffer,
+                         const Face& default_face, const Face& padding_face);
+
 }
 
 #endif // json_ui_hh_INCLUDED
@@ -11,9 +11,11 @@
 #include "event_manager.hh"
 #include "face_registry.hh"
 #include "file.hh"
+#include "highlighter_cache.hh"
 #include "highlighters.hh"
 #include "insert_completer.hh"
 #include "json_ui.hh"
+#include "binary_ui.hh"
 #include "terminal_ui.hh"
 #include "option_types.hh"
 #include "parameters_parser.hh"
@@ -521,6 +523,42 @@ static void check_timeout(const int& timeout)
         throw runtime_error{"the minimum acceptable timeout is 50 milliseconds"};
 }
 
+static void check_timer_slack(const int& slack)
+{
+    if (slack < 0)
+        throw runtime_error{"timer slack should be positive or zero"};
+}
+
+static void check_max_fps(const int& fps)
+{
+    if (fps < 0)
+        throw runtime_error{"max fps should be positive or zero"};
+}
+
+static void check_highlight_cache_size(const int& size)
+{
+    if (size < 0)
+        throw runtime_error{"highlight cache size should be positive or zero"};
+}
+
+static void check_long_line_length(const int& length)
+{
+    if (length < 0)
+        throw runtime_error{"long line length should be positive or zero"};
+}
+
+static void check_shell_workers(const int& count)
+{
+    if (count < 0)
+        throw runtime_error{"shell workers count should be positive or zero"};
+}
+
+static void check_pipe_jobs(const int& count)
+{
+    if (count < 1)
+        throw runtime_error{"pipe jobs count should be strictly positive"};
+}
+
 static void check_extra_word_chars(const Vector<Codepoint, MemoryDomain::Options>& extra_chars)
 {
     if (any_of(extra_chars, is_blank))
@@ -586,6 +624,12 @@ void register_options()
     reg.declare_option<int, check_timeout>(
         "fs_check_timeout", "timeout, in milliseconds, between file system buffer modification checks",
         500);
+    reg.declare_option<int, check_timer_slack>(
+        "timer_slack", "delay, in milliseconds, by which timers can be run late so that close ones run together",
+        0);
+    reg.declare_option<int, check_max_fps>(
+        "max_fps", "maximum number of frames drawn per second by a client, 0 for no limit",
+        0);
     reg.declare_option("ui_options",
                        "space separated list of <key>=<value> options that are "
                        "passed to and interpreted by the user interface\n"
@@ -618,6 +662,14 @@ void register_options()
         "set of pair of characters to be considered as matching pairs",
         { '(', ')', '{', '}', '[', ']', '<', '>' });
     reg.declare_option<int>("startup_info_version", "version up to which startup info changes should be hidden", 0);
+    reg.declare_option<int, check_highlight_cache_size>(
+        "highlight_cache_size", "maximum memory, in kilobytes, used by highlighter caches", 65536);
+    reg.declare_option<int, check_long_line_length>(
+        "long_line_length", "length, in bytes, above which only the visible part of lines is displayed", 65536);
+    reg.declare_option<int, check_shell_workers>(
+        "shell_workers", "number of long lived shells used to run shell scripts, 0 to spawn a shell per script", 0);
+    reg.declare_option<int, check_pipe_jobs>(
+        "pipe_jobs", "maximum number of shells run at once when piping multiple selections", 1);
 }
 
 static Client* local_client = nullptr;
@@ -627,6 +679,7 @@ enum class UIType
 {
     Terminal,
     Json,
+    Binary,
     Dummy,
 };
 
@@ -634,6 +687,7 @@ UIType parse_ui_type(StringView ui_name)
 {
     if (ui_name == "terminal") return UIType::Terminal;
     if (ui_name == "json") return UIType::Json;
+    if (ui_name == "binary") return UIType::Binary;
     if (ui_name == "dummy") return UIType::Dummy;
 
     throw parameter_error(format("error: unknown ui type: '{}'", ui_name));
@@ -667,6 +721,7 @@ std::unique_ptr<UserInterface> make_ui(UIType ui_type)
     {
         case UIType::Terminal: return std::make_unique<TerminalUI>();
         case UIType::Json: return std::make_unique<JsonUI>();
+        case UIType::Binary: return std::make_unique<BinaryUI>();
         case UIType::Dummy: return std::make_unique<DummyUI>();
     }
     throw logic_error{};
@@ -674,13 +729,22 @@ std::unique_ptr<UserInterface> make_ui(UIType ui_type)
 
 pid_t fork_server_to_background()
 {
+    Server::instance().pause_remote_threads();
+    // shell workers are children of the process that will become a client
+    ShellManager::instance().stop_workers();
     if (pid_t pid = fork())
+    {
+        // the server keeps polling its watchers, ensure we do not modify its poller
+        EventManager::instance().reset_poller();
         return pid;
+    }
 
     setsid();
     if (fork()) // double fork to orphan the server
         exit(0);
 
+    Server::instance().resume_remote_threads();
+
     write_stderr(format("Kakoune forked server to background ({}), for session '{}'\n",
                         getpid(), Server::instance().session()));
     return 0;
@@ -794,6 +858,8 @@ int run_server(StringView session, StringView server_init,
     RegisterManager     register_manager;
     HighlighterRegistry highlighter_registry;
     SharedHighlighters  defined_highlighters;
+    HighlighterProfiler highlighter_profiler;
+    HighlighterCacheManager highlighter_cache_manager;
     ClientManager       client_manager;
     BufferManager       buffer_manager;
 
@@ -907,12 +973,18 @@ int run_server(StringView session, StringView server_init,
             // Loop so that eventual inputs happening during the processing are handled as
             // well, avoiding unneeded redraws.
             bool allow_blocking = not client_manager.has_pending_inputs();
+            event_manager.set_timer_slack(std::chrono::milliseconds{global_scope.options()["timer_slack"].get<int>()});
             try
             {
                 while (event_manager.handle_next_events(EventMode::Normal, nullptr, allow_blocking))
                 {
                     if (client_manager.process_pending_inputs())
+                    {
+                        // gather inputs received during processing so that clients
+                        // can skip drawing frames they would immediately supersede.
+                        event_manager.handle_next_events(EventMode::Normal, nullptr, false);
                         break;
+                    }
                     allow_blocking = false;
                 }
             }
@@ -959,6 +1031,7 @@ int run_server(StringView session, StringView server_init,
         exit_status = kill.exit_status;
     }
 
+    shell_manager.cancel_async_jobs();
     {
         Context empty_context{Context::EmptyContextFlag{}};
         global_scope.hooks().run_hook(Hook::KakEnd, "", empty_context);
@@ -1032,11 +1105,14 @@ int run_filter(StringView keystr, ConstArrayView<StringView> files, bool quiet,
     return 0;
 }
 
-int run_pipe(StringView session)
+int run_pipe(StringView session, bool channel)
 {
     try
     {
-        send_command(session, read_fd(0));
+        if (channel)
+            pipe_commands(session);
+        else
+            send_command(session, read_fd(0));
     }
     catch (disconnected& e)
     {
@@ -1102,10 +1178,11 @@ int main(int argc, char* argv[])
                    { "s", { ArgCompleter{},  "set session name" } },
                    { "d", { {}, "run as a headless session (requires -s)" } },
                    { "p", { ArgCompleter{},  "just send stdin as commands to the given session" } },
+                   { "P", { ArgCompleter{},  "send each line of stdin as a command to the given session, and print their results" } },
                    { "f", { ArgCompleter{},  "filter: for each file, select the entire buffer and execute the given keys" } },
                    { "i", { ArgCompleter{}, "backup the files on which a filter is applied using the given suffix" } },
                    { "q", { {}, "in filter mode, be quiet about errors applying keys" } },
-                   { "ui", { ArgCompleter{}, "set the type of user interface to use (terminal, dummy, or json)" } },
+                   { "ui", { ArgCompleter{}, "set the type of user interface to use (terminal, dummy, json or binary)" } },
                    { "l", { {}, "list existing sessions" } },
                    { "clear", { {}, "clear dead sessions" } },
                    { "debug", { ArgCompleter{}, "initial debug option value" } },
@@ -1161,17 +1238,21 @@ int main(int argc, char* argv[])
             return 0;
         }
 
-        if (auto session = parser.get_switch("p"))
+        for (auto pipe_opt : { "p", "P" })
         {
-            for (auto opt : { "c", "n", "s", "d", "e", "E", "ro" })
+            auto session = parser.get_switch(pipe_opt);
+            if (not session)
+                continue;
+
+            for (auto opt : { "c", "n", "s", "d", "e", "E", "ro", "p", "P" })
             {
-                if (parser.get_switch(opt))
+                if (opt != StringView{pipe_opt} and parser.get_switch(opt))
                 {
-                    write_stderr(format("error: -{} is incompatible with -p\n", opt));
+                    write_stderr(format("error: -{} is incompatible with -{}\n", opt, pipe_opt));
                     return -1;
                 }
             }
-            return run_pipe(*session);
+            return run_pipe(*session, pipe_opt == StringView{"P"});
         }
 
         auto client_init = parser.get_switch("e").value_or(StringView{});
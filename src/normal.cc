@@ -591,7 +591,32 @@ void pipe(Context& context, NormalParams params)
                 return;
 
             Buffer& buffer = context.buffer();
-            if (replace)
+            const int jobs = context.options()["pipe_jobs"].get<int>();
+            if (replace and jobs > 1 and context.selections().size() > 1)
+            {
+                buffer.throw_if_read_only();
+                ScopedEdition edition(context);
+                SelectionList selections = context.selections();
+                auto restore_selections = on_scope_end([&] {
+                    context.selections_write_only() = std::move(selections);
+                });
+
+                const auto inputs = context.selections_content();
+                auto outputs = ShellManager::instance().eval_parallel(
+                    cmdline, context, inputs, jobs, [&](size_t index) {
+                        // Needed in case we read selections inside the cmdline
+                        context.selections_write_only().set({selections[index]}, 0);
+                    });
+
+                for (size_t i = 0; i < outputs.size(); ++i)
+                {
+                    auto& out = outputs[i];
+                    if (inputs[i].back() != '\n' and not out.empty() and out.back() == '\n')
+                        out.resize(out.length()-1, 0);
+                }
+                selections.replace(outputs);
+            }
+            else if (replace)
             {
                 buffer.throw_if_read_only();
                 ScopedEdition edition(context);
@@ -7,13 +7,15 @@
 namespace Kakoune
 {
 
-OptionDesc::OptionDesc(String name, String docstring, OptionFlags flags)
+OptionDesc::OptionDesc(String name, String docstring, OptionFlags flags, size_t index)
     : m_name(std::move(name)), m_docstring(std::move(docstring)),
-    m_flags(flags) {}
+    m_flags(flags), m_index(index) {}
 
 Option::Option(const OptionDesc& desc, OptionManager& manager)
     : m_manager(manager), m_desc(desc) {}
 
+size_t OptionManager::s_generation = 0;
+
 OptionManager::OptionManager(OptionManager& parent)
     : m_parent(&parent)
 {
@@ -35,6 +37,7 @@ void OptionManager::reparent(OptionManager& parent)
 
     m_parent = &parent;
     parent.register_watcher(*this);
+    on_options_structure_changed();
 }
 
 void OptionManager::register_watcher(OptionManagerWatcher& watcher) const
@@ -64,6 +67,7 @@ Option& OptionManager::get_local_option(StringView name)
     else if (m_parent)
     {
         auto* clone = (*m_parent)[name].clone(*this);
+        on_options_structure_changed();
         return *m_options.insert({clone->name(), std::unique_ptr<Option>{clone}});
     }
     else
@@ -73,13 +77,49 @@ Option& OptionManager::get_local_option(StringView name)
 
 Option& OptionManager::operator[](StringView name)
 {
-    auto it = m_options.find(name);
-    if (it != m_options.end())
-        return *it->value;
-    else if (m_parent)
-        return (*m_parent)[name];
-    else
+    auto* desc = GlobalScope::instance().option_registry().option_desc(name);
+    if (not desc)
         throw option_not_found(name);
+    return resolve(*desc);
+}
+
+bool OptionManager::resolved_is_valid() const
+{
+    for (auto* manager = this; manager; manager = manager->m_parent)
+    {
+        if (manager->m_generation > m_resolved_generation)
+            return false;
+    }
+    return true;
+}
+
+Option& OptionManager::resolve(const OptionDesc& desc)
+{
+    // managers without options of their own, such as most local scopes,
+    // use their parent cache instead of filling one that dies with them
+    if (m_options.empty() and m_parent)
+        return m_parent->resolve(desc);
+
+    if (not resolved_is_valid())
+    {
+        m_resolved.clear();
+        m_resolved_generation = s_generation;
+    }
+
+    const size_t index = desc.index();
+    if (index < m_resolved.size() and m_resolved[index])
+        return *m_resolved[index];
+
+    for (auto* manager = this; manager; manager = manager->m_parent)
+    {
+        if (auto it = manager->m_options.find(desc.name()); it != manager->m_options.end())
+        {
+            if (index >= m_resolved.size())
+                m_resolved.resize(index + 1, nullptr);
+            return *(m_resolved[index] = it->value.get());
+        }
+    }
+    throw option_not_found(desc.name());
 }
 
 const Option& OptionManager::operator[](StringView name) const
@@ -97,6 +137,7 @@ void OptionManager::unset_option(StringView name)
         const bool changed = not parent_option.has_same_value(*it->value);
         GlobalScope::instance().option_registry().move_to_trash(std::move(it->value));
         m_options.erase(name);
+        on_options_structure_changed();
         if (changed)
             on_option_changed(parent_option);
     }
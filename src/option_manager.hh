@@ -7,6 +7,7 @@
 #include "option.hh"
 #include "option_types.hh"
 #include "ranges.hh"
+#include "ref_ptr.hh"
 #include "vector.hh"
 #include "format.hh"
 #include "string_utils.hh"
@@ -31,9 +32,11 @@ constexpr bool with_bit_ops(Meta::Type<OptionFlags>) { return true; }
 class OptionDesc
 {
 public:
-    OptionDesc(String name, String docstring, OptionFlags flags);
+    OptionDesc(String name, String docstring, OptionFlags flags, size_t index);
 
     const String& name() const { return m_name; }
+    // stable identifier, used to index the options resolved by managers
+    size_t index() const { return m_index; }
     const String& docstring() const { return m_docstring; }
 
     OptionFlags flags() const { return m_flags; }
@@ -42,6 +45,7 @@ private:
     String m_name;
     String m_docstring;
     OptionFlags  m_flags;
+    size_t m_index;
 };
 
 class Option : public UseMemoryDomain<MemoryDomain::Options>
@@ -60,6 +64,8 @@ public:
     virtual void set_from_strings(ConstArrayView<String> strs) = 0;
     virtual void add_from_strings(ConstArrayView<String> strs) = 0;
     virtual void remove_from_strings(ConstArrayView<String> strs) = 0;
+    // replace the elements starting on lines first to last, 1 based
+    virtual void replace_lines_from_strings(const Context& context, LineCount first, LineCount last, ConstArrayView<String> strs) = 0;
     virtual void update(const Context& context) = 0;
 
     virtual bool has_same_value(const Option& other) const = 0;
@@ -123,46 +129,65 @@ private:
     friend class OptionsRegistry;
     using OptionMap = HashMap<StringView, std::unique_ptr<Option>, MemoryDomain::Options>;
 
+    Option& resolve(const OptionDesc& desc);
+    void on_options_structure_changed() { m_generation = ++s_generation; }
+    bool resolved_is_valid() const;
+
     OptionMap m_options;
     OptionManager* m_parent;
 
+    // Options found for this manager, indexed by option desc index. Entries
+    // point into this manager or its parents, so they are dropped when one of
+    // these managers adds or removes an option, or changes parent, which sets
+    // its generation past the one the entries were resolved at.
+    Vector<Option*, MemoryDomain::Options> m_resolved;
+    size_t m_resolved_generation = 0;
+    size_t m_generation = 0;
+    static size_t s_generation;
+
     mutable Vector<OptionManagerWatcher*, MemoryDomain::Options> m_watchers;
 };
 
+// Option values are shared between an option and its clones until one of
+// them gets modified, so that overriding a big list option in a new scope
+// does not copy the list it is about to replace.
 template<typename T>
 class TypedOption : public Option
 {
 public:
     TypedOption(OptionManager& manager, const OptionDesc& desc, const T& value)
-        : Option(desc, manager), m_value(value) {}
+        : Option(desc, manager), m_value(new Value{value}) {}
 
     void set(T value, bool notify = true)
     {
         validate(value);
-        if (m_value != value)
+        if (m_value->value != value)
         {
-            m_value = std::move(value);
+            if (m_value->refcount == 1)
+                m_value->value = std::move(value);
+            else
+                m_value.reset(new Value{std::move(value)});
             if (notify)
                 manager().on_option_changed(*this);
         }
     }
-    const T& get() const { return m_value; }
-    T& get_mutable() { return m_value; }
+    const T& get() const { return m_value->value; }
+    T& get_mutable() { return unshared_value(); }
 
     Vector<String> get_as_strings() const override
     {
-        return option_to_strings(m_value);
+        return option_to_strings(get());
     }
 
     String get_as_string(Quoting quoting) const override
     {
-        return option_to_string(m_value, quoting);
+        return option_to_string(get(), quoting);
     }
 
     String get_desc_string() const override
     {
         if constexpr (std::is_same_v<int, T> or std::is_same_v<bool, T> or std::is_same_v<String, T>)
-            return option_to_string(m_value, Quoting::Raw);
+            return option_to_string(get(), Quoting::Raw);
         else
             return "...";
     }
@@ -174,28 +199,54 @@ public:
 
     void add_from_strings(ConstArrayView<String> strs) override
     {
-        if (option_add_from_strings(m_value, strs))
+        if (option_add_from_strings(unshared_value(), strs))
             m_manager.on_option_changed(*this);
     }
 
     void remove_from_strings(ConstArrayView<String> strs) override
     {
-        if (option_remove_from_strings(m_value, strs))
+        if (option_remove_from_strings(unshared_value(), strs))
+            m_manager.on_option_changed(*this);
+    }
+
+    void replace_lines_from_strings(const Context& context, LineCount first, LineCount last, ConstArrayView<String> strs) override
+    {
+        if (option_replace_lines_from_strings(unshared_value(), context, first, last, strs))
             m_manager.on_option_changed(*this);
     }
 
     void update(const Context& context) override
     {
-        option_update(m_value, context);
+        option_update(unshared_value(), context);
     }
 
     bool has_same_value(const Option& other) const override
     {
-        return other.is_of_type<T>() and other.get<T>() == m_value;
+        auto* typed_other = dynamic_cast<const TypedOption*>(&other);
+        return typed_other and (typed_other->m_value == m_value or typed_other->get() == get());
     }
+
+protected:
+    TypedOption(OptionManager& manager, const TypedOption& other)
+        : Option(other.m_desc, manager), m_value(other.m_value) {}
+
 private:
     virtual void validate(const T& value) const {}
-    T m_value;
+
+    struct Value : RefCountable, UseMemoryDomain<MemoryDomain::Options>
+    {
+        Value(T value) : value(std::move(value)) {}
+        T value;
+    };
+
+    T& unshared_value()
+    {
+        if (m_value->refcount > 1)
+            m_value.reset(new Value{m_value->value});
+        return m_value->value;
+    }
+
+    RefPtr<Value> m_value;
 };
 
 template<typename T, void (*validator)(const T&)>
@@ -205,7 +256,7 @@ class TypedCheckedOption : public TypedOption<T>
 
     Option* clone(OptionManager& manager) const override
     {
-        return new TypedCheckedOption{manager, this->m_desc, this->get()};
+        return new TypedCheckedOption{manager, *this};
     }
 
     void validate(const T& value) const override { if (validator != nullptr) validator(value); }
@@ -222,7 +273,11 @@ template<typename T> const T& Option::get() const
 
 template<typename T> T& Option::get_mutable()
 {
-    return const_cast<T&>(get<T>());
+    auto* typed_opt = dynamic_cast<TypedOption<T>*>(this);
+    if (not typed_opt)
+        throw runtime_error(format("option '{}' is not of type '{}'", name(),
+                                   option_type_name(Meta::Type<T>{})));
+    return typed_opt->get_mutable();
 }
 
 template<typename T> void Option::set(const T& val, bool notify)
@@ -266,17 +321,16 @@ public:
         }
         String doc =  docstring.empty() ? format("[{}]", option_type_name(Meta::Type<T>{}))
                                         : format("[{}] - {}", option_type_name(Meta::Type<T>{}), docstring);
-        m_descs.emplace_back(new OptionDesc{name.str(), std::move(doc), flags});
+        m_descs.emplace_back(new OptionDesc{name.str(), std::move(doc), flags, m_descs.size()});
+        m_desc_map.insert({m_descs.back()->name(), m_descs.back().get()});
         return *opts.insert({m_descs.back()->name(),
                              std::make_unique<TypedCheckedOption<T, validator>>(m_global_manager, *m_descs.back(), value)});
     }
 
     const OptionDesc* option_desc(StringView name) const
     {
-        auto it = find_if(m_descs,
-                          [&name](const std::unique_ptr<const OptionDesc>& opt)
-                          { return opt->name() == name; });
-        return it != m_descs.end() ? it->get() : nullptr;
+        auto it = m_desc_map.find(name);
+        return it != m_desc_map.end() ? it->value : nullptr;
     }
 
     bool option_exists(StringView name) const { return option_desc(name) != nullptr; }
@@ -288,6 +342,7 @@ public:
 private:
     OptionManager& m_global_manager;
     Vector<std::unique_ptr<const OptionDesc>, MemoryDomain::Options> m_descs;
+    HashMap<StringView, const OptionDesc*, MemoryDomain::Options> m_desc_map;
     Vector<std::unique_ptr<Option>> m_option_trash;
 };
 
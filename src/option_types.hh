@@ -13,6 +13,7 @@
 #include "units.hh"
 #include "ranges.hh"
 
+#include <algorithm>
 #include <tuple>
 #include <vector>
 
@@ -119,14 +120,24 @@ bool option_add_from_strings(Vector<T, domain>& opt, ConstArrayView<String> strs
 template<typename T, MemoryDomain domain>
 bool option_remove_from_strings(Vector<T, domain>& opt, ConstArrayView<String> strs)
 {
+    // mark the first remaining occurence of each value, then compact the list once
+    Vector<bool> removed(opt.size(), false);
     bool did_remove = false;
     for (auto&& val : strs | transform([](auto&& s) { return option_from_string(Meta::Type<T>{}, s); }))
     {
-        auto it = find(opt, val);
-        if (it == opt.end())
-            continue;
-        opt.erase(it);
-        did_remove = true;
+        for (size_t i = 0; i < opt.size(); ++i)
+        {
+            if (not removed[i] and opt[i] == val)
+            {
+                removed[i] = did_remove = true;
+                break;
+            }
+        }
+    }
+    if (did_remove)
+    {
+        size_t index = 0;
+        opt.erase(std::remove_if(opt.begin(), opt.end(), [&](const T&) { return removed[index++]; }), opt.end());
     }
     return did_remove;
 }
@@ -284,6 +295,11 @@ inline bool option_remove(WorstMatch, StringView)
 
 class Context;
 
+inline bool option_replace_lines_from_strings(WorstMatch, const Context&, LineCount, LineCount, ConstArrayView<String>)
+{
+    throw runtime_error("no line replace operation supported for this option type");
+}
+
 inline void option_update(WorstMatch, const Context&)
 {
     throw runtime_error("no update operation supported for this option type");
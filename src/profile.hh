@@ -23,6 +23,8 @@ public:
       : ProfileScope{context.options()["debug"].get<DebugFlags>(), std::move(callback), active}
     {}
 
+    bool active() const { return m_active; }
+
     ~ProfileScope()
     {
         if (m_active)
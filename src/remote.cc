@@ -1,4 +1,5 @@
 #include "remote.hh"
+#include "remote_protocol.hh"
 
 #include "buffer_utils.hh"
 #include "debug.hh"
@@ -11,6 +12,11 @@
 #include "optional.hh"
 #include "user_interface.hh"
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -21,371 +27,276 @@
 #include <pwd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 
 
 namespace Kakoune
 {
 
-enum class MessageType : uint8_t
-{
-    Unknown,
-    Connect,
-    Command,
-    MenuShow,
-    MenuSelect,
-    MenuHide,
-    InfoShow,
-    InfoHide,
-    Draw,
-    DrawStatus,
-    SetCursor,
-    Refresh,
-    SetOptions,
-    Exit,
-    Key,
-    Paste,
-};
-
-class MsgWriter
+// Sends the messages written through it to a socket from a dedicated thread,
+// so that writing to a remote client socket does not delay the server.
+//
+// Each message is written to its own segment, and segments are sent with a
+// single gathering sendmsg. Segment buffers are reused once sent, and unsent
+// messages that are superseded by a newer one can be dropped when the client
+// falls behind.
+//
+// Memory domain accounting is not thread safe, so buffers are only allocated
+// and freed on the main thread, the sending thread only reads the segments.
+class RemoteSender
 {
 public:
-    MsgWriter(RemoteBuffer& buffer, MessageType type)
-        : m_buffer{buffer}, m_start{(uint32_t)buffer.size()}
+    RemoteSender(int socket) : m_socket{socket}
     {
-        write_field(type);
-        write_field((uint32_t)0); // message size, to be patched on write
+        if (pipe(m_wakeup_pipe) == 0)
+        {
+            for (int fd : m_wakeup_pipe)
+            {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+            }
+        }
+        senders().push_back(this);
+        start();
     }
 
-    ~MsgWriter()
+    ~RemoteSender()
     {
-        uint32_t count = (uint32_t)m_buffer.size() - m_start;
-        memcpy(m_buffer.data() + m_start + sizeof(MessageType), &count, sizeof(uint32_t));
+        stop();
+        unordered_erase(senders(), this);
+        for (int fd : m_wakeup_pipe)
+        {
+            if (fd != -1)
+                close(fd);
+        }
     }
 
     template<typename ...Args>
-    void write(Args&&... args)
+    void send_message(MessageType type, Args&&... args)
     {
-        (write_field(std::forward<Args>(args)), ...);
+        RemoteBuffer buffer;
+        if (not m_free_buffers.empty())
+        {
+            buffer = std::move(m_free_buffers.back());
+            m_free_buffers.pop_back();
+        }
+        {
+            MsgWriter msg{buffer, type};
+            msg.write(std::forward<Args>(args)...);
+        }
+        {
+            std::lock_guard lock{m_mutex};
+            reclaim_sent_segments();
+            m_segments.push_back({type, std::move(buffer)});
+        }
+        m_condition.notify_one();
     }
 
-private:
-    void write_raw(const char* val, size_t size)
+    // drop the messages of given type that have not started to be sent,
+    // returns true if some were dropped.
+    bool drop_unsent(MessageType type)
     {
-        m_buffer.insert(m_buffer.end(), val, val + size);
+        std::lock_guard lock{m_mutex};
+        // partition rather than remove, so that the dropped segments buffers get recycled
+        auto it = std::stable_partition(m_segments.begin() + m_in_flight_end, m_segments.end(),
+                                        [&](const Segment& segment) { return segment.type != type; });
+        if (it == m_segments.end())
+            return false;
+
+        for (auto& segment : ArrayView{&*it, (size_t)(m_segments.end() - it)})
+            recycle(std::move(segment.data));
+        m_segments.erase(it, m_segments.end());
+        return true;
     }
 
-    template<typename T>
-    void write_field(const T& val)
-    {
-        static_assert(std::is_trivially_copyable<T>::value, "");
-        write_raw((const char*)&val, sizeof(val));
-    }
+    bool failed() const { return m_failed; }
 
-    void write_field(StringView str)
+    // stop the sending thread, sending the remaining data if it can be done without blocking
+    void stop()
     {
-        write_field(str.length());
-        write_raw(str.data(), (int)str.length());
-    };
+        set_state(State::Stopping);
+    }
 
-    void write_field(const String& str)
+    // threads do not survive fork, sending threads need to be paused before forking, and
+    // restarted in the process that keeps handling the clients, if any.
+    static void pause_all()
     {
-        write_field(StringView{str});
+        for (auto* sender : senders())
+            sender->set_state(State::Paused);
     }
 
-    template<typename T>
-    void write_field(ConstArrayView<T> view)
+    static void resume_all()
     {
-        write_field<uint32_t>(view.size());
-        for (auto& val : view)
-            write_field(val);
+        for (auto* sender : senders())
+            sender->start();
     }
 
-    template<typename T, MemoryDomain domain>
-    void write_field(const Vector<T, domain>& vec)
+private:
+    enum class State { Running, Paused, Stopping };
+
+    struct Segment
     {
-        write_field(ConstArrayView<T>(vec));
-    }
+        MessageType type;
+        RemoteBuffer data;
+    };
 
-    template<typename Key, typename Val, MemoryDomain domain>
-    void write_field(const HashMap<Key, Val, domain>& map)
+    static Vector<RemoteSender*, MemoryDomain::Remote>& senders()
     {
-        write_field<uint32_t>(map.size());
-        for (auto& val : map)
-        {
-            write_field(val.key);
-            write_field(val.value);
-        }
+        static Vector<RemoteSender*, MemoryDomain::Remote> senders;
+        return senders;
     }
 
-    template<typename T>
-    void write_field(const Optional<T>& val)
+    void start()
     {
-        write_field((bool)val);
-        if (val)
-            write_field(*val);
+        if (m_thread.joinable() or m_state == State::Stopping)
+            return;
+
+        m_state = State::Running;
+        // signals are expected to be handled by the main thread
+        sigset_t all_signals, old_mask;
+        sigfillset(&all_signals);
+        pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+        m_thread = std::thread{[this] { run(); }};
+        pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
     }
 
-    void write_field(Color color)
+    void set_state(State state)
     {
-        write_field(color.color);
-        if (color.isRGB())
         {
-            write_field(color.r);
-            write_field(color.g);
-            write_field(color.b);
+            std::lock_guard lock{m_mutex};
+            if (m_state != State::Stopping)
+                m_state = state;
         }
+        m_condition.notify_one();
+        // the thread might be waiting for the socket to be writable
+        if (m_wakeup_pipe[1] != -1)
+            (void)::write(m_wakeup_pipe[1], "", 1);
+        if (m_thread.joinable())
+            m_thread.join();
     }
 
-    void write_field(const DisplayAtom& atom)
+    // move fully sent segments buffers to the free list, called on the main thread
+    void reclaim_sent_segments()
     {
-        write_field(atom.content());
-        write_field(atom.face);
+        if (m_sent_segments == 0)
+            return;
+
+        for (auto& segment : ArrayView{m_segments.data(), m_sent_segments})
+            recycle(std::move(segment.data));
+        m_segments.erase(m_segments.begin(), m_segments.begin() + m_sent_segments);
+        m_in_flight_end -= m_sent_segments;
+        m_sent_segments = 0;
     }
 
-    void write_field(const DisplayLine& line)
+    void recycle(RemoteBuffer&& buffer)
     {
-        write_field(line.atoms());
+        constexpr size_t max_free_buffers = 16;
+        if (m_free_buffers.size() < max_free_buffers)
+        {
+            buffer.clear();
+            m_free_buffers.push_back(std::move(buffer));
+        }
     }
 
-    void write_field(const DisplayBuffer& display_buffer)
+    void run()
     {
-        write_field(display_buffer.lines());
-    }
-
-private:
-    RemoteBuffer& m_buffer;
-    uint32_t m_start;
-};
-
-class MsgReader
-{
-private:
-    template<typename T>
-    struct Reader {
-        static T read(MsgReader& reader)
-        {
-            static_assert(std::is_trivially_copyable<T>::value, "");
-            T res;
-            reader.read(reinterpret_cast<char*>(&res), sizeof(T));
-            return res;
-        }
-    };
+        constexpr size_t max_iov = 64;
+        iovec iov[max_iov];
 
-    template<typename T, MemoryDomain domain>
-    struct Reader<Vector<T,domain>> {
-        static Vector<T, domain> read(MsgReader& reader)
+        std::unique_lock lock{m_mutex};
+        while (true)
         {
-            uint32_t size = Reader<uint32_t>::read(reader);
-            Vector<T,domain> res;
-            res.reserve(size);
-            while (size--)
-                res.push_back(std::move(Reader<T>::read(reader)));
-            return res;
-        }
-    };
-
-    template<typename T>
-    struct Reader<ArrayView<T>> : Reader<Vector<std::remove_cv_t<T>, MemoryDomain::Undefined>> {};
+            m_condition.wait(lock, [this] { return m_sent_segments < m_segments.size() or m_state != State::Running; });
+            if (m_state == State::Paused or m_sent_segments == m_segments.size())
+                return;
 
-    template<typename Key, typename Value, MemoryDomain domain>
-    struct Reader<HashMap<Key, Value, domain>> {
-        static HashMap<Key, Value, domain> read(MsgReader& reader)
-        {
-            uint32_t size = Reader<uint32_t>::read(reader);
-            HashMap<Key, Value, domain> res;
-            res.reserve(size);
-            while (size--)
+            // segment data is not modified until sent, and does not move when m_segments is
+            // modified, so it can be sent without holding the lock.
+            size_t count = 0;
+            for (size_t i = m_sent_segments; i < m_segments.size() and count < max_iov; ++i, ++count)
             {
-                auto key = Reader<Key>::read(reader);
-                auto val = Reader<Value>::read(reader);
-                res.insert({std::move(key), std::move(val)});
+                auto& data = m_segments[i].data;
+                const size_t offset = count == 0 ? m_sent_bytes : 0;
+                iov[count] = {data.data() + offset, data.size() - offset};
             }
-            return res;
-        }
-    };
+            m_in_flight_end = m_sent_segments + count;
 
-    template<typename T>
-    struct Reader<Optional<T>> {
-        static Optional<T> read(MsgReader& reader)
-        {
-            if (not Reader<bool>::read(reader))
-                return {};
-            return Reader<T>::read(reader);
-        }
-    };
+            const bool stopping = m_state == State::Stopping;
+            lock.unlock();
+            // without a wakeup pipe, wake up regularly to check for state changes
+            const auto sent = send_available({iov, count}, stopping ? 0 : (m_wakeup_pipe[0] != -1 ? -1 : 100));
+            lock.lock();
 
-public:
-    void read_available(int sock)
-    {
-        if (m_write_pos < header_size)
-        {
-            m_stream.resize(header_size);
-            read_from_socket(sock, header_size - m_write_pos);
-            if (m_write_pos == header_size)
+            for (auto remaining = sent; remaining > 0; )
             {
-                if (size() < header_size)
-                    throw disconnected{"invalid message received"};
-                m_stream.resize(size());
+                const size_t segment_left = m_segments[m_sent_segments].data.size() - m_sent_bytes;
+                const size_t consumed = std::min(remaining, segment_left);
+                remaining -= consumed;
+                m_sent_bytes += consumed;
+                if (consumed == segment_left)
+                {
+                    ++m_sent_segments;
+                    m_sent_bytes = 0;
+                }
             }
-        }
-        else
-            read_from_socket(sock, size() - m_write_pos);
-    }
-
-    bool ready() const
-    {
-        return m_write_pos >= header_size and m_write_pos == size();
-    }
-
-    uint32_t size() const
-    {
-        kak_assert(m_write_pos >= header_size);
-        uint32_t res;
-        memcpy(&res, m_stream.data() + sizeof(MessageType), sizeof(uint32_t));
-        return res;
-    }
-
-    MessageType type() const
-    {
-        kak_assert(m_write_pos >= header_size);
-        return *reinterpret_cast<const MessageType*>(m_stream.data());
-    }
-
-    void read(char* buffer, size_t size)
-    {
-        if (m_read_pos + size > m_stream.size())
-            throw disconnected{"tried to read after message end"};
-        memcpy(buffer, m_stream.data() + m_read_pos, size);
-        m_read_pos += size;
-    }
-
-    template<typename T>
-    auto read()
-    {
-        return Reader<T>::read(*this);
-    }
-
-    Optional<int> ancillary_fd()
-    {
-        auto res = m_ancillary_fd;
-        m_ancillary_fd.reset();
-        return res;
-    }
-
-    ~MsgReader()
-    {
-        m_ancillary_fd.map(close);
-    }
-
-    void reset()
-    {
-        m_stream.resize(0);
-        m_write_pos = 0;
-        m_read_pos = header_size;
-        m_ancillary_fd.map(close);
-    }
-
-private:
-    void read_from_socket(int sock, size_t size)
-    {
-        kak_assert(m_write_pos + size <= m_stream.size());
-        iovec io{m_stream.data() + m_write_pos, size};
-        alignas(cmsghdr) char fdbuf[CMSG_SPACE(sizeof(int))];
-
-        msghdr msg{};
-        msg.msg_iov = &io;
-        msg.msg_iovlen = 1;
-        msg.msg_control = fdbuf;
-        msg.msg_controllen = sizeof(fdbuf);
+            m_in_flight_end = m_sent_segments + (m_sent_bytes != 0 ? 1 : 0);
 
-        int res = recvmsg(sock, &msg, 0);
-        if (res <= 0)
-            throw disconnected{format("socket read failed: {}", strerror(errno))};
-
-        m_write_pos += res;
-
-        if (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
-            cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
-        {
-            m_ancillary_fd.map(close);
-            memcpy(&m_ancillary_fd.emplace(), CMSG_DATA(cmsg), sizeof(int));
-            fcntl(*m_ancillary_fd, F_SETFD, FD_CLOEXEC);
+            if (m_failed or (stopping and sent == 0))
+                return;
         }
     }
 
-    static constexpr uint32_t header_size = sizeof(MessageType) + sizeof(uint32_t);
-    Vector<char, MemoryDomain::Remote> m_stream;
-    Optional<int> m_ancillary_fd;
-    uint32_t m_write_pos = 0;
-    uint32_t m_read_pos = header_size;
-};
-
-template<>
-struct MsgReader::Reader<String> {
-    static String read(MsgReader& reader)
+    size_t send_available(ArrayView<iovec> iov, int timeout)
     {
-        ByteCount length = Reader<ByteCount>::read(reader);
-        String res;
-        if (length > 0)
+        pollfd pfds[] = {{m_socket, POLLOUT, 0}, {m_wakeup_pipe[0], POLLIN, 0}};
+        if (poll(pfds, m_wakeup_pipe[0] != -1 ? 2 : 1, timeout) <= 0)
+            return 0;
+        if (pfds[1].revents & POLLIN)
         {
-            res.force_size((int)length);
-            reader.read(&res[0_byte], (int)length);
+            char buf[64];
+            while (::read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0)
+                ;
         }
-        return res;
-    }
-};
+        if (pfds[0].revents == 0)
+            return 0;
 
-template<>
-struct MsgReader::Reader<Color> {
-    static Color read(MsgReader& reader)
-    {
-        Color res;
-        res.color = Reader<Color::NamedColor>::read(reader);
-        if (res.isRGB())
+        msghdr msg{};
+        msg.msg_iov = iov.begin();
+        msg.msg_iovlen = iov.size();
+        const auto res = sendmsg(m_socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (res < 0 and (errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR))
+            return 0;
+        if (res <= 0)
         {
-            res.r = Reader<unsigned char>::read(reader);
-            res.g = Reader<unsigned char>::read(reader);
-            res.b = Reader<unsigned char>::read(reader);
+            m_failed = true;
+            return 0;
         }
         return res;
     }
-};
-
-template<>
-struct MsgReader::Reader<DisplayAtom> {
-    static DisplayAtom read(MsgReader& reader)
-    {
-        String content = Reader<String>::read(reader);
-        return {std::move(content), Reader<Face>::read(reader)};
-    }
-};
-
-template<>
-struct MsgReader::Reader<DisplayLine> {
-    static DisplayLine read(MsgReader& reader)
-    {
-        return {Reader<Vector<DisplayAtom>>::read(reader)};
-    }
-};
 
-template<>
-struct MsgReader::Reader<DisplayBuffer> {
-    static DisplayBuffer read(MsgReader& reader)
-    {
-        DisplayBuffer db;
-        db.lines() = Reader<Vector<DisplayLine>>::read(reader);
-        return db;
-    }
+    const int m_socket;
+    int m_wakeup_pipe[2] = {-1, -1}; // written to when the state changes
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    State m_state = State::Paused;
+    std::atomic<bool> m_failed = false;
+
+    Vector<Segment, MemoryDomain::Remote> m_segments;
+    size_t m_sent_segments = 0; // segments fully sent, waiting to be reclaimed
+    size_t m_sent_bytes = 0;    // bytes sent from the first unsent segment
+    size_t m_in_flight_end = 0; // segments before that one might be being sent
+    Vector<RemoteBuffer, MemoryDomain::Remote> m_free_buffers; // only accessed by the main thread
 };
 
-
 class RemoteUI : public UserInterface
 {
 public:
-    RemoteUI(int socket, DisplayCoord dimensions);
+    RemoteUI(int socket, DisplayCoord dimensions, uint32_t protocol_version);
     ~RemoteUI() override;
 
-    bool is_ok() const override { return m_socket_watcher.fd() != -1; }
+    bool is_ok() const override { return m_socket_watcher.fd() != -1 and not m_sender.failed(); }
     void menu_show(ConstArrayView<DisplayLine> choices,
                    DisplayCoord anchor, Face fg, Face bg,
                    MenuStyle style) override;
@@ -425,17 +336,24 @@ private:
     template<typename ...Args>
     void send_message(MessageType type, Args&&... args)
     {
-        MsgWriter msg{m_send_buffer, type};
-        msg.write(std::forward<Args>(args)...);
-        m_socket_watcher.events() |= FdEvents::Write;
+        m_sender.send_message(type, std::forward<Args>(args)...);
+    }
+
+    void disconnect()
+    {
+        m_sender.stop();
+        m_socket_watcher.close_fd();
     }
 
     FDWatcher     m_socket_watcher;
+    RemoteSender  m_sender;
     MsgReader     m_reader;
     DisplayCoord  m_dimensions;
     OnKeyCallback m_on_key;
     OnPasteCallback m_on_paste;
-    RemoteBuffer  m_send_buffer;
+
+    const bool    m_draw_delta;
+    DrawDeltaTracker m_delta_tracker;
 };
 
 static bool send_data(int fd, RemoteBuffer& buffer, Optional<int> ancillary_fd = {})
@@ -468,15 +386,12 @@ static bool send_data(int fd, RemoteBuffer& buffer, Optional<int> ancillary_fd =
     return buffer.empty();
 }
 
-RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
-    : m_socket_watcher(socket,  FdEvents::Read | FdEvents::Write, EventMode::Urgent,
+RemoteUI::RemoteUI(int socket, DisplayCoord dimensions, uint32_t protocol_version)
+    : m_socket_watcher(socket,  FdEvents::Read, EventMode::Urgent,
                        [this](FDWatcher& watcher, FdEvents events, EventMode) {
           const int sock = watcher.fd();
           try
           {
-              if (events & FdEvents::Write and send_data(sock, m_send_buffer))
-                  m_socket_watcher.events() &= ~FdEvents::Write;
-
               while (events & FdEvents::Read and fd_readable(sock))
               {
                   m_reader.read_available(sock);
@@ -500,7 +415,7 @@ RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
                    }
                    else
                    {
-                       m_socket_watcher.close_fd();
+                       disconnect();
                        return;
                    }
               }
@@ -508,10 +423,12 @@ RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
           catch (const disconnected& err)
           {
               write_to_debug_buffer(format("Error while transfering remote messages: {}", err.what()));
-              m_socket_watcher.close_fd();
+              disconnect();
           }
       }),
-      m_dimensions(dimensions)
+      m_sender(socket),
+      m_dimensions(dimensions),
+      m_draw_delta(protocol_version >= 1)
 {
     write_to_debug_buffer(format("remote client connected: {}", m_socket_watcher.fd()));
 }
@@ -519,17 +436,8 @@ RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
 RemoteUI::~RemoteUI()
 {
     // Try to send the remaining data if possible, as it might contain the desired exit status
-    try
-    {
-        if (m_socket_watcher.fd() != -1)
-            send_data(m_socket_watcher.fd(), m_send_buffer);
-    }
-    catch (disconnected&)
-    {
-    }
-
     write_to_debug_buffer(format("remote client disconnected: {}", m_socket_watcher.fd()));
-    m_socket_watcher.close_fd();
+    disconnect();
 }
 
 void RemoteUI::menu_show(ConstArrayView<DisplayLine> choices,
@@ -565,13 +473,27 @@ void RemoteUI::draw(const DisplayBuffer& display_buffer,
                     const Face& default_face,
                     const Face& padding_face)
 {
-    send_message(MessageType::Draw, display_buffer, default_face, padding_face);
+    // drop the previous frames the client did not start receiving, as this one supersedes them
+    if (not m_draw_delta)
+    {
+        m_sender.drop_unsent(MessageType::Draw);
+        return send_message(MessageType::Draw, display_buffer, default_face, padding_face);
+    }
+
+    // dropped deltas might contain changed lines and new faces, send everything again
+    if (m_sender.drop_unsent(MessageType::DrawDelta))
+        m_delta_tracker.reset();
+
+    auto delta = m_delta_tracker.update(display_buffer);
+    send_message(MessageType::DrawDelta, delta.first_face_id, delta.new_faces, default_face, padding_face,
+                 delta.line_count, delta.changed_lines);
 }
 
 void RemoteUI::draw_status(const DisplayLine& status_line,
                            const DisplayLine& mode_line,
                            const Face& default_face)
 {
+    m_sender.drop_unsent(MessageType::DrawStatus);
     send_message(MessageType::DrawStatus, status_line, mode_line, default_face);
 }
 
@@ -658,32 +580,33 @@ bool check_session(StringView session)
 RemoteClient::RemoteClient(StringView session, StringView name, std::unique_ptr<UserInterface>&& ui,
                            int pid, const EnvVarMap& env_vars, StringView init_command,
                            Optional<BufferCoord> init_coord, Optional<int> stdin_fd)
-    : m_ui(std::move(ui))
+    : m_ui(std::move(ui)), m_display_buffer(new DisplayBuffer{})
 {
     int sock = connect_to(session);
 
     {
         MsgWriter msg{m_send_buffer, MessageType::Connect};
-        msg.write(pid, name, init_command, init_coord, m_ui->dimensions(), env_vars);
+        msg.write(pid, name, init_command, init_coord, m_ui->dimensions(), env_vars,
+                  remote_protocol_version);
     }
     send_data(sock, m_send_buffer, stdin_fd);
 
     m_ui->set_on_key([this](Key key){
         MsgWriter msg(m_send_buffer, MessageType::Key);
         msg.write(key);
-        m_socket_watcher->events() |= FdEvents::Write;
+        m_socket_watcher->set_events(m_socket_watcher->events() | FdEvents::Write);
      });
     m_ui->set_on_paste([this](StringView content){
         MsgWriter msg(m_send_buffer, MessageType::Paste);
         msg.write(content);
-        m_socket_watcher->events() |= FdEvents::Write;
+        m_socket_watcher->set_events(m_socket_watcher->events() | FdEvents::Write);
      });
 
     m_socket_watcher.reset(new FDWatcher{sock, FdEvents::Read | FdEvents::Write, EventMode::Urgent,
                            [this, reader = MsgReader{}](FDWatcher& watcher, FdEvents events, EventMode) mutable {
         const int sock = watcher.fd();
         if (events & FdEvents::Write and send_data(sock, m_send_buffer))
-            watcher.events() &= ~FdEvents::Write;
+            watcher.set_events(watcher.events() & ~FdEvents::Write);
 
         auto exec = [&]<typename ...Args>(void (UserInterface::*method)(Args...)) {
             struct Impl // Use a constructor to ensure left-to-right parameter evaluation
@@ -725,6 +648,9 @@ RemoteClient::RemoteClient(StringView session, StringView name, std::unique_ptr<
             case MessageType::Draw:
                 exec(&UserInterface::draw);
                 break;
+            case MessageType::DrawDelta:
+                apply_draw_delta(reader);
+                break;
             case MessageType::DrawStatus:
                 exec(&UserInterface::draw_status);
                 break;
@@ -748,6 +674,45 @@ RemoteClient::RemoteClient(StringView session, StringView name, std::unique_ptr<
     }});
 }
 
+RemoteClient::~RemoteClient() = default;
+
+void RemoteClient::apply_draw_delta(MsgReader& reader)
+{
+    const auto first_face_id = reader.read<uint32_t>();
+    if (first_face_id == 0)
+        m_faces.clear();
+    else if (first_face_id != m_faces.size())
+        throw disconnected{"invalid draw delta face table"};
+    for (auto& face : reader.read<Vector<Face, MemoryDomain::Remote>>())
+        m_faces.push_back(face);
+    auto default_face = reader.read<Face>();
+    auto padding_face = reader.read<Face>();
+
+    auto& lines = m_display_buffer->lines();
+    lines.resize(reader.read<uint32_t>());
+    for (uint32_t count = reader.read<uint32_t>(); count > 0; --count)
+    {
+        const auto index = reader.read<uint32_t>();
+        if (index >= lines.size())
+            throw disconnected{"invalid draw delta line index"};
+
+        AtomList atoms;
+        const auto atom_count = reader.read<uint32_t>();
+        atoms.reserve(atom_count);
+        while (atoms.size() < atom_count)
+        {
+            auto content = reader.read<String>();
+            const auto face_id = reader.read<uint32_t>();
+            if (face_id >= m_faces.size())
+                throw disconnected{"invalid draw delta face index"};
+            atoms.push_back({std::move(content), m_faces[face_id]});
+        }
+        lines[index] = DisplayLine{std::move(atoms)};
+    }
+
+    m_ui->draw(*m_display_buffer, default_face, padding_face);
+}
+
 bool RemoteClient::is_ui_ok() const
 {
     return m_ui->is_ok();
@@ -765,6 +730,91 @@ void send_command(StringView session, StringView command)
     write(sock, {buffer.data(), buffer.data() + buffer.size()});
 }
 
+void pipe_commands(StringView session)
+{
+    int sock = connect_to(session);
+    auto close_sock = on_scope_end([sock]{ close(sock); });
+
+    RemoteBuffer send_buffer;
+    {
+        MsgWriter msg{send_buffer, MessageType::CommandChannel};
+    }
+    MsgReader reader;
+    String partial_line;
+    String results;
+    uint32_t sent = 0, received = 0;
+    bool input_done = false;
+
+    while (not input_done or received != sent)
+    {
+        pollfd fds[] = {{input_done ? -1 : 0, POLLIN, 0},
+                        {sock, short(POLLIN | (send_buffer.empty() ? 0 : POLLOUT)), 0}};
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(format("poll failed: {}", strerror(errno)));
+        }
+
+        if (fds[0].revents)
+        {
+            char buf[4096];
+            ssize_t size = read(0, buf, sizeof(buf));
+            if (size <= 0)
+                input_done = true;
+            else
+                partial_line += StringView{buf, buf + size};
+
+            // each line is a command, a final line without end of line is sent on end of input
+            auto line_begin = partial_line.begin();
+            for (auto it = line_begin; it != partial_line.end(); ++it)
+            {
+                if (*it != '\n' and not (input_done and it + 1 == partial_line.end()))
+                    continue;
+                StringView command{line_begin, *it == '\n' ? it : it + 1};
+                line_begin = it + 1;
+                if (command.empty())
+                    continue;
+                MsgWriter msg{send_buffer, MessageType::CommandRequest};
+                msg.write(sent++, command);
+            }
+            partial_line = StringView{line_begin, partial_line.end()}.str();
+        }
+
+        if (fds[1].revents & POLLOUT)
+            send_data(sock, send_buffer);
+
+        // read even when no result is pending so that the server closing
+        // the connection is noticed, reading 0 bytes throws disconnected
+        if (fds[1].revents & (POLLERR | POLLNVAL) and not (fds[1].revents & POLLIN))
+            throw disconnected("connection error");
+        if (fds[1].revents & (POLLIN | POLLHUP))
+        {
+            while (fd_readable(sock))
+            {
+                reader.read_available(sock);
+                if (not reader.ready())
+                    continue;
+                if (reader.type() != MessageType::CommandResult or received == sent)
+                    throw disconnected("invalid message received");
+
+                reader.read<uint32_t>(); // results come in request order
+                auto success = reader.read<bool>();
+                auto error = reader.read<String>();
+                reader.reset();
+                ++received;
+                results += success ? "ok\n" : format("error: {}\n", replace(error, "\n", " "));
+            }
+        }
+
+        if (not results.empty())
+        {
+            write(1, results);
+            results.clear();
+        }
+    }
+}
+
 
 // A client accepter handle a connection until it closes or a nul byte is
 // recieved. Everything recieved before is considered to be a command.
@@ -804,11 +854,14 @@ private:
                 auto init_coord = m_reader.read<Optional<BufferCoord>>();
                 auto dimensions = m_reader.read<DisplayCoord>();
                 auto env_vars = m_reader.read<HashMap<String, String, MemoryDomain::EnvVars>>();
+                auto protocol_version = m_reader.at_end() ? 0 : m_reader.read<uint32_t>();
 
                 if (auto stdin_fd = m_reader.ancillary_fd())
                     create_fifo_buffer(generate_buffer_name("*stdin-{}*"), *stdin_fd, Buffer::Flags::None);
 
-                auto* ui = new RemoteUI{sock, dimensions};
+                // the socket is handed over, stop watching it before the new owner does
+                m_socket_watcher.disable();
+                auto* ui = new RemoteUI{sock, dimensions, protocol_version};
                 ClientManager::instance().create_client(
                     std::unique_ptr<UserInterface>(ui), pid, std::move(name),
                     std::move(env_vars), init_cmds, {}, init_coord,
@@ -830,20 +883,25 @@ private:
                     write_to_debug_buffer(format("error running command '{}': {}",
                                                  command, e.what()));
                 }
-                close(sock);
+                m_socket_watcher.close_fd();
                 Server::instance().remove_accepter(this);
                 break;
             }
+            case MessageType::CommandChannel:
+                m_socket_watcher.disable();
+                Server::instance().add_command_channel(sock);
+                Server::instance().remove_accepter(this);
+                break;
             default:
                 write_to_debug_buffer("invalid introduction message received");
-                close(sock);
+                m_socket_watcher.close_fd();
                 Server::instance().remove_accepter(this);
             }
         }
         catch (const disconnected& err)
         {
             write_to_debug_buffer(format("accepting connection failed: {}", err.what()));
-            close(sock);
+            m_socket_watcher.close_fd();
             Server::instance().remove_accepter(this);
         }
     }
@@ -852,6 +910,76 @@ private:
     MsgReader m_reader;
 };
 
+// A command channel is a connection that stays open to run commands in an
+// empty context, it is opened by a CommandChannel introduction message.
+//
+// Each CommandRequest message gets a CommandResult reply with the same id,
+// requests can be pipelined and are replied to in order.
+class Server::CommandChannel
+{
+public:
+    CommandChannel(int socket)
+        : m_socket_watcher(socket, FdEvents::Read, EventMode::Normal,
+                           [this](FDWatcher&, FdEvents, EventMode mode) {
+                               handle_available_input(mode);
+                           }),
+          m_sender(socket)
+    {}
+
+    ~CommandChannel()
+    {
+        m_sender.stop();
+        m_socket_watcher.close_fd();
+    }
+
+private:
+    void handle_available_input(EventMode mode)
+    {
+        // bound the requests handled at once so that other events are not delayed
+        constexpr int max_requests = 64;
+        const int sock = m_socket_watcher.fd();
+        try
+        {
+            for (int count = 0; mode == EventMode::Normal and count < max_requests and fd_readable(sock); )
+            {
+                m_reader.read_available(sock);
+                if (not m_reader.ready())
+                    continue;
+
+                if (m_reader.type() != MessageType::CommandRequest)
+                    throw disconnected("invalid message received");
+
+                auto id = m_reader.read<uint32_t>();
+                auto command = m_reader.read<String>();
+                m_reader.reset();
+                ++count;
+
+                try
+                {
+                    Context context{Context::EmptyContextFlag{}};
+                    CommandManager::instance().execute(command, context);
+                    m_sender.send_message(MessageType::CommandResult, id, true, StringView{});
+                }
+                catch (const runtime_error& e)
+                {
+                    m_sender.send_message(MessageType::CommandResult, id, false, StringView{e.what()});
+                }
+
+                if (m_sender.failed())
+                    throw disconnected("socket write failed");
+            }
+        }
+        catch (const disconnected&)
+        {
+            Server::instance().remove_command_channel(this);
+        }
+    }
+
+    FDWatcher m_socket_watcher;
+    RemoteSender m_sender;
+    MsgReader m_reader;
+};
+
 Server::Server(String session_name, bool is_daemon)
     : m_session{std::move(session_name)}, m_is_daemon{is_daemon}
 {
@@ -887,6 +1015,16 @@ Server::Server(String session_name, bool is_daemon)
     m_listener.reset(new FDWatcher{listen_sock, FdEvents::Read, EventMode::Urgent, accepter});
 }
 
+void Server::pause_remote_threads()
+{
+    RemoteSender::pause_all();
+}
+
+void Server::resume_remote_threads()
+{
+    RemoteSender::resume_all();
+}
+
 bool Server::rename_session(StringView name)
 {
     String old_socket_file = session_path(m_session);
@@ -919,6 +1057,18 @@ Server::~Server()
         close_session();
 }
 
+void Server::add_command_channel(int socket)
+{
+    m_command_channels.emplace_back(new CommandChannel{socket});
+}
+
+void Server::remove_command_channel(CommandChannel* channel)
+{
+    auto it = find(m_command_channels, channel);
+    kak_assert(it != m_command_channels.end());
+    m_command_channels.erase(it);
+}
+
 void Server::remove_accepter(Accepter* accepter)
 {
     auto it = find(m_accepters, accepter);
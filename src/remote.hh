@@ -3,6 +3,7 @@
 
 #include "env_vars.hh"
 #include "exception.hh"
+#include "face.hh"
 #include "utils.hh"
 #include "vector.hh"
 #include "optional.hh"
@@ -19,6 +20,8 @@ struct disconnected : runtime_error
 
 class FDWatcher;
 class UserInterface;
+class DisplayBuffer;
+class MsgReader;
 
 template<typename T> struct Optional;
 struct BufferCoord;
@@ -33,17 +36,25 @@ public:
     RemoteClient(StringView session, StringView name, std::unique_ptr<UserInterface>&& ui,
                  int pid, const EnvVarMap& env_vars, StringView init_command,
                  Optional<BufferCoord> init_coord, Optional<int> stdin_fd);
+    ~RemoteClient();
 
     bool is_ui_ok() const;
     const Optional<int>& exit_status() const { return m_exit_status; }
 private:
+    void apply_draw_delta(MsgReader& reader);
+
     std::unique_ptr<UserInterface> m_ui;
     std::unique_ptr<FDWatcher>     m_socket_watcher;
+    std::unique_ptr<DisplayBuffer> m_display_buffer; // last drawn lines, updated by DrawDelta
+    Vector<Face, MemoryDomain::Remote> m_faces;     // face table referenced by DrawDelta
     RemoteBuffer                   m_send_buffer;
     Optional<int>                  m_exit_status;
 };
 
 void send_command(StringView session, StringView command);
+// send each line read from stdin as a command through a command channel,
+// and write one line per result on stdout
+void pipe_commands(StringView session);
 String get_user_name();
 const String& session_directory();
 String session_path(StringView session);
@@ -59,17 +70,27 @@ struct Server : public Singleton<Server>
 
     bool negotiating() const { return not m_accepters.empty(); }
 
+    // remote clients are written to from dedicated threads, which do not
+    // survive forking, they need to be paused before forking and resumed
+    // in the process that keeps running the server.
+    void pause_remote_threads();
+    void resume_remote_threads();
+
     void daemonize() { m_is_daemon = true; }
     bool is_daemon() const { return m_is_daemon; }
 
 private:
     class Accepter;
+    class CommandChannel;
     void remove_accepter(Accepter* accepter);
+    void add_command_channel(int socket);
+    void remove_command_channel(CommandChannel* channel);
 
     String m_session;
     bool m_is_daemon;
     std::unique_ptr<FDWatcher> m_listener;
     Vector<std::unique_ptr<Accepter>, MemoryDomain::Remote> m_accepters;
+    Vector<std::unique_ptr<CommandChannel>, MemoryDomain::Remote> m_command_channels;
 };
 
 bool check_session(StringView session);
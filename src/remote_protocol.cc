@@ -0,0 +1,53 @@
+#include "remote_protocol.hh"
+
+namespace Kakoune
+{
+
+static size_t hash_line(const DisplayLine& line)
+{
+    size_t hash = hash_value(line.atoms().size());
+    for (auto& atom : line)
+        hash = combine_hash(hash, hash_values(atom.content(), atom.face));
+    return (hash << 1) | 1; // ensure non-zero
+}
+
+// Only the lines that changed since last update are sent, the client keeps the
+// previous lines to rebuild the display. Faces are sent once and then referenced
+// by their index in the client face table, each message appends the new faces to
+// that table starting at first_face_id, a zero first_face_id restarts the table.
+DrawDeltaTracker::Delta DrawDeltaTracker::update(const DisplayBuffer& display_buffer)
+{
+    const auto& lines = display_buffer.lines();
+    m_line_hashes.resize(lines.size(), 0);
+
+    if (m_face_ids.size() >= max_face_table_size)
+        m_face_ids.clear();
+
+    Delta delta{(uint32_t)m_face_ids.size(), {}, (uint32_t)lines.size(), {}};
+    for (uint32_t index = 0; index < lines.size(); ++index)
+    {
+        const size_t hash = hash_line(lines[index]);
+        if (hash == m_line_hashes[index])
+            continue;
+        m_line_hashes[index] = hash;
+
+        for (auto& atom : lines[index])
+        {
+            if (not m_face_ids.contains(atom.face))
+            {
+                m_face_ids.insert({atom.face, (uint32_t)m_face_ids.size()});
+                delta.new_faces.push_back(atom.face);
+            }
+        }
+        delta.changed_lines.push_back({index, &lines[index], &m_face_ids});
+    }
+    return delta;
+}
+
+void DrawDeltaTracker::reset()
+{
+    m_line_hashes.clear();
+    m_face_ids.clear();
+}
+
+}
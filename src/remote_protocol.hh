@@ -0,0 +1,456 @@
+#ifndef remote_protocol_hh_INCLUDED
+#define remote_protocol_hh_INCLUDED
+
+#include "display_buffer.hh"
+#include "format.hh"
+#include "hash_map.hh"
+#include "optional.hh"
+#include "remote.hh"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace Kakoune
+{
+
+// Messages exchanged between a server and its remote clients, also used by
+// the binary user interface.
+enum class MessageType : uint8_t
+{
+    Unknown,
+    Connect,
+    Command,
+    MenuShow,
+    MenuSelect,
+    MenuHide,
+    InfoShow,
+    InfoHide,
+    Draw,
+    DrawStatus,
+    SetCursor,
+    Refresh,
+    SetOptions,
+    Exit,
+    Key,
+    Paste,
+    DrawDelta,
+    CommandChannel,
+    CommandRequest,
+    CommandResult,
+};
+
+// Version of the protocol supported by this client, sent at the end of the
+// Connect message. Older clients do not send it, and are considered version 0.
+//
+// * version 1: server can send DrawDelta messages instead of Draw
+constexpr uint32_t remote_protocol_version = 1;
+
+// Maximum number of faces in a remote client face table, when reached the
+// table is restarted from scratch on next draw.
+constexpr size_t max_face_table_size = 4096;
+
+// Line of a DrawDelta message, faces are written as indices into the
+// client face table.
+struct DrawDeltaLine
+{
+    uint32_t index;
+    const DisplayLine* line;
+    const HashMap<Face, uint32_t, MemoryDomain::Remote>* face_ids;
+};
+
+class MsgWriter
+{
+public:
+    MsgWriter(RemoteBuffer& buffer, MessageType type)
+        : m_buffer{buffer}, m_start{(uint32_t)buffer.size()}
+    {
+        write_field(type);
+        write_field((uint32_t)0); // message size, to be patched on write
+    }
+
+    ~MsgWriter()
+    {
+        uint32_t count = (uint32_t)m_buffer.size() - m_start;
+        memcpy(m_buffer.data() + m_start + sizeof(MessageType), &count, sizeof(uint32_t));
+    }
+
+    template<typename ...Args>
+    void write(Args&&... args)
+    {
+        (write_field(std::forward<Args>(args)), ...);
+    }
+
+private:
+    void write_raw(const char* val, size_t size)
+    {
+        m_buffer.insert(m_buffer.end(), val, val + size);
+    }
+
+    template<typename T>
+    void write_field(const T& val)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "");
+        write_raw((const char*)&val, sizeof(val));
+    }
+
+    void write_field(StringView str)
+    {
+        write_field(str.length());
+        write_raw(str.data(), (int)str.length());
+    };
+
+    void write_field(const String& str)
+    {
+        write_field(StringView{str});
+    }
+
+    template<typename T>
+    void write_field(ConstArrayView<T> view)
+    {
+        write_field<uint32_t>(view.size());
+        for (auto& val : view)
+            write_field(val);
+    }
+
+    template<typename T, MemoryDomain domain>
+    void write_field(const Vector<T, domain>& vec)
+    {
+        write_field(ConstArrayView<T>(vec));
+    }
+
+    template<typename Key, typename Val, MemoryDomain domain>
+    void write_field(const HashMap<Key, Val, domain>& map)
+    {
+        write_field<uint32_t>(map.size());
+        for (auto& val : map)
+        {
+            write_field(val.key);
+            write_field(val.value);
+        }
+    }
+
+    template<typename T>
+    void write_field(const Optional<T>& val)
+    {
+        write_field((bool)val);
+        if (val)
+            write_field(*val);
+    }
+
+    void write_field(Color color)
+    {
+        write_field(color.color);
+        if (color.isRGB())
+        {
+            write_field(color.r);
+            write_field(color.g);
+            write_field(color.b);
+        }
+    }
+
+    void write_field(const DisplayAtom& atom)
+    {
+        write_field(atom.content());
+        write_field(atom.face);
+    }
+
+    void write_field(const DisplayLine& line)
+    {
+        write_field(line.atoms());
+    }
+
+    void write_field(const DisplayBuffer& display_buffer)
+    {
+        write_field(display_buffer.lines());
+    }
+
+    void write_field(const DrawDeltaLine& delta_line)
+    {
+        write_field(delta_line.index);
+        write_field<uint32_t>(delta_line.line->atoms().size());
+        for (auto& atom : *delta_line.line)
+        {
+            write_field(atom.content());
+            write_field(delta_line.face_ids->find(atom.face)->value);
+        }
+    }
+
+private:
+    RemoteBuffer& m_buffer;
+    uint32_t m_start;
+};
+
+class MsgReader
+{
+private:
+    template<typename T>
+    struct Reader {
+        static T read(MsgReader& reader)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "");
+            T res;
+            reader.read(reinterpret_cast<char*>(&res), sizeof(T));
+            return res;
+        }
+    };
+
+    template<typename T, MemoryDomain domain>
+    struct Reader<Vector<T,domain>> {
+        static Vector<T, domain> read(MsgReader& reader)
+        {
+            uint32_t size = Reader<uint32_t>::read(reader);
+            Vector<T,domain> res;
+            res.reserve(size);
+            while (size--)
+                res.push_back(std::move(Reader<T>::read(reader)));
+            return res;
+        }
+    };
+
+    template<typename T>
+    struct Reader<ArrayView<T>> : Reader<Vector<std::remove_cv_t<T>, MemoryDomain::Undefined>> {};
+
+    template<typename Key, typename Value, MemoryDomain domain>
+    struct Reader<HashMap<Key, Value, domain>> {
+        static HashMap<Key, Value, domain> read(MsgReader& reader)
+        {
+            uint32_t size = Reader<uint32_t>::read(reader);
+            HashMap<Key, Value, domain> res;
+            res.reserve(size);
+            while (size--)
+            {
+                auto key = Reader<Key>::read(reader);
+                auto val = Reader<Value>::read(reader);
+                res.insert({std::move(key), std::move(val)});
+            }
+            return res;
+        }
+    };
+
+    template<typename T>
+    struct Reader<Optional<T>> {
+        static Optional<T> read(MsgReader& reader)
+        {
+            if (not Reader<bool>::read(reader))
+                return {};
+            return Reader<T>::read(reader);
+        }
+    };
+
+public:
+    void read_available(int sock)
+    {
+        fill([&](size_t size) { return read_from_socket(sock, size); });
+    }
+
+    // read from data up to the end of the current message, advancing data
+    void read_available(const char*& data, const char* end)
+    {
+        fill([&](size_t size) {
+            size = std::min(size, (size_t)(end - data));
+            memcpy(m_stream.data() + m_write_pos, data, size);
+            data += size;
+            return size;
+        });
+    }
+
+    bool ready() const
+    {
+        return m_write_pos >= header_size and m_write_pos == size();
+    }
+
+    uint32_t size() const
+    {
+        kak_assert(m_write_pos >= header_size);
+        uint32_t res;
+        memcpy(&res, m_stream.data() + sizeof(MessageType), sizeof(uint32_t));
+        return res;
+    }
+
+    MessageType type() const
+    {
+        kak_assert(m_write_pos >= header_size);
+        return *reinterpret_cast<const MessageType*>(m_stream.data());
+    }
+
+    void read(char* buffer, size_t size)
+    {
+        if (m_read_pos + size > m_stream.size())
+            throw disconnected{"tried to read after message end"};
+        memcpy(buffer, m_stream.data() + m_read_pos, size);
+        m_read_pos += size;
+    }
+
+    template<typename T>
+    auto read()
+    {
+        return Reader<T>::read(*this);
+    }
+
+    bool at_end() const
+    {
+        return m_read_pos == m_stream.size();
+    }
+
+    Optional<int> ancillary_fd()
+    {
+        auto res = m_ancillary_fd;
+        m_ancillary_fd.reset();
+        return res;
+    }
+
+    ~MsgReader()
+    {
+        m_ancillary_fd.map(close);
+    }
+
+    void reset()
+    {
+        m_stream.resize(0);
+        m_write_pos = 0;
+        m_read_pos = header_size;
+        m_ancillary_fd.map(close);
+    }
+
+private:
+    // read_at_most(size) should append up to size bytes to m_stream at m_write_pos
+    // and return the number of bytes appended.
+    template<typename Func>
+    void fill(Func read_at_most)
+    {
+        if (m_write_pos < header_size)
+        {
+            m_stream.resize(header_size);
+            m_write_pos += read_at_most(header_size - m_write_pos);
+            if (m_write_pos == header_size)
+            {
+                if (size() < header_size)
+                    throw disconnected{"invalid message received"};
+                m_stream.resize(size());
+            }
+        }
+        else
+            m_write_pos += read_at_most(size() - m_write_pos);
+    }
+
+    size_t read_from_socket(int sock, size_t size)
+    {
+        kak_assert(m_write_pos + size <= m_stream.size());
+        iovec io{m_stream.data() + m_write_pos, size};
+        alignas(cmsghdr) char fdbuf[CMSG_SPACE(sizeof(int))];
+
+        msghdr msg{};
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+        msg.msg_control = fdbuf;
+        msg.msg_controllen = sizeof(fdbuf);
+
+        int res = recvmsg(sock, &msg, 0);
+        if (res <= 0)
+            throw disconnected{format("socket read failed: {}", strerror(errno))};
+
+        if (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+        {
+            m_ancillary_fd.map(close);
+            memcpy(&m_ancillary_fd.emplace(), CMSG_DATA(cmsg), sizeof(int));
+            fcntl(*m_ancillary_fd, F_SETFD, FD_CLOEXEC);
+        }
+        return res;
+    }
+
+    static constexpr uint32_t header_size = sizeof(MessageType) + sizeof(uint32_t);
+    Vector<char, MemoryDomain::Remote> m_stream;
+    Optional<int> m_ancillary_fd;
+    uint32_t m_write_pos = 0;
+    uint32_t m_read_pos = header_size;
+};
+
+template<>
+struct MsgReader::Reader<String> {
+    static String read(MsgReader& reader)
+    {
+        ByteCount length = Reader<ByteCount>::read(reader);
+        String res;
+        if (length > 0)
+        {
+            res.force_size((int)length);
+            reader.read(&res[0_byte], (int)length);
+        }
+        return res;
+    }
+};
+
+template<>
+struct MsgReader::Reader<Color> {
+    static Color read(MsgReader& reader)
+    {
+        Color res;
+        res.color = Reader<Color::NamedColor>::read(reader);
+        if (res.isRGB())
+        {
+            res.r = Reader<unsigned char>::read(reader);
+            res.g = Reader<unsigned char>::read(reader);
+            res.b = Reader<unsigned char>::read(reader);
+        }
+        return res;
+    }
+};
+
+template<>
+struct MsgReader::Reader<DisplayAtom> {
+    static DisplayAtom read(MsgReader& reader)
+    {
+        String content = Reader<String>::read(reader);
+        return {std::move(content), Reader<Face>::read(reader)};
+    }
+};
+
+template<>
+struct MsgReader::Reader<DisplayLine> {
+    static DisplayLine read(MsgReader& reader)
+    {
+        return {Reader<Vector<DisplayAtom>>::read(reader)};
+    }
+};
+
+template<>
+struct MsgReader::Reader<DisplayBuffer> {
+    static DisplayBuffer read(MsgReader& reader)
+    {
+        DisplayBuffer db;
+        db.lines() = Reader<Vector<DisplayLine>>::read(reader);
+        return db;
+    }
+};
+
+
+// Tracks the lines and faces a client already received so that draws
+// can be sent as DrawDelta messages.
+class DrawDeltaTracker
+{
+public:
+    struct Delta
+    {
+        uint32_t first_face_id;
+        Vector<Face, MemoryDomain::Remote> new_faces;
+        uint32_t line_count;
+        Vector<DrawDeltaLine, MemoryDomain::Remote> changed_lines;
+    };
+
+    // the returned delta references display_buffer lines
+    Delta update(const DisplayBuffer& display_buffer);
+
+    // forget what the client received, next delta will contain everything
+    void reset();
+
+private:
+    Vector<size_t, MemoryDomain::Remote> m_line_hashes;
+    HashMap<Face, uint32_t, MemoryDomain::Remote> m_face_ids;
+};
+
+}
+
+#endif // remote_protocol_hh_INCLUDED
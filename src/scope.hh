@@ -15,13 +15,13 @@ namespace Kakoune
 class Scope
 {
 public:
-    Scope(Scope& parent)
+    Scope(Scope& parent, StringView name)
         : m_options(parent.options()),
           m_hooks(parent.hooks()),
           m_keymaps(parent.keymaps()),
           m_aliases(parent.aliases()),
           m_faces(parent.faces()),
-          m_highlighters(parent.highlighters()) {}
+          m_highlighters(parent.highlighters(), name) {}
 
     OptionManager&       options()            { return m_options; }
     const OptionManager& options()      const { return m_options; }
@@ -1,6 +1,7 @@
 #include "shell_manager.hh"
 
 #include "debug.hh"
+#include "buffer.hh"
 #include "client.hh"
 #include "clock.hh"
 #include "context.hh"
@@ -16,6 +17,7 @@
 #include <array>
 #include <cstring>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -114,6 +116,13 @@ Shell spawn_shell(const char* shell, StringView cmdline,
     auto stdin_pipe = open_stdin ? make_pipe() : std::array{UniqueFd{open("/dev/null", O_RDONLY)}, UniqueFd{}};
     auto stdout_pipe = make_pipe();
     auto stderr_pipe = make_pipe();
+    // the ends we keep must not leak into other shells spawned while this one
+    // runs, that would prevent them from seeing end of file.
+    for (auto* fd : {&stdin_pipe[1], &stdout_pipe[0], &stderr_pipe[0]})
+    {
+        if (*fd)
+            fcntl((int)*fd, F_SETFD, FD_CLOEXEC);
+    }
     if (pid_t pid = vfork())
         return {pid, std::move(stdin_pipe[1]), std::move(stdout_pipe[0]), std::move(stderr_pipe[0])};
 
@@ -139,50 +148,21 @@ Shell spawn_shell(const char* shell, StringView cmdline,
     return {-1, {}, {}, {}};
 }
 
-template<typename GetValue>
-Vector<String> generate_env(StringView cmdline, ConstArrayView<String> params, const Context& context, GetValue&& get_value)
-{
-    static const Regex re(R"(\bkak_(quoted_)?(\w+)\b)");
-
-    Vector<String> env;
-    auto add_matches = [&](StringView s) {
-        for (auto&& match : RegexIterator{s.begin(), s.end(), re})
-        {
-            StringView name{match[2].first, match[2].second};
-            StringView shell_name{match[0].first, match[0].second};
-
-            auto match_name = [&](const String& s) {
-                return s.substr(0_byte, shell_name.length()) == shell_name and
-                       s.substr(shell_name.length(), 1_byte) == "=";
-            };
-            if (any_of(env, match_name))
-                continue;
-
-            try
-            {
-                StringView quoted{match[1].first, match[1].second};
-                Quoting quoting = match[1].matched ? Quoting::Shell : Quoting::Raw;
-                env.push_back(format("kak_{}{}={}", quoted, name, get_value(name, quoting)));
-            } catch (runtime_error&) {}
-        }
-    };
-    add_matches(cmdline);
-    for (auto&& param : params)
-        add_matches(param);
-
-    return env;
-}
-
 template<typename OnClose>
 FDWatcher make_reader(int fd, String& contents, OnClose&& on_close)
 {
     return {fd, FdEvents::Read, EventMode::Urgent,
             [&contents, on_close](FDWatcher& watcher, FdEvents, EventMode) {
         const int fd = watcher.fd();
-        char buffer[1024];
         while (fd_readable(fd))
         {
-            ssize_t size = ::read(fd, buffer, sizeof(buffer));
+            // read directly at the end of contents, reading bigger chunks
+            // as the output grows so that large outputs need less reads.
+            const ByteCount length = contents.length();
+            const int chunk_size = clamp((int)length, 4096, 1 << 20);
+            contents.resize(length + chunk_size, 0);
+            ssize_t size = ::read(fd, contents.data() + (int)length, chunk_size);
+            contents.resize(length + (int)std::max<ssize_t>(size, 0), 0);
             if (size <= 0)
             {
                 if (size < 0 and errno == EAGAIN)
@@ -192,35 +172,58 @@ FDWatcher make_reader(int fd, String& contents, OnClose&& on_close)
                 on_close(size == 0);
                 return;
             }
-            contents += StringView{buffer, buffer+size};
         }
     }};
 }
 
-FDWatcher make_pipe_writer(UniqueFd& fd, const FunctionRef<StringView ()>& generator)
+// The generated strings are gathered and written with a single writev call,
+// so they need to stay valid until the generator returns an empty string.
+template<typename Generator>
+FDWatcher make_pipe_writer(UniqueFd& fd, Generator& generator)
 {
     int flags = fcntl((int)fd, F_GETFL, 0);
     fcntl((int)fd, F_SETFL, flags | O_NONBLOCK);
     return {(int)fd, FdEvents::Write, EventMode::Urgent,
-            [&generator, &fd, contents=generator()](FDWatcher& watcher, FdEvents, EventMode) mutable {
-        while (fd_writable((int)fd))
+            [&generator, &fd, pending=Vector<StringView>{}, generated=false](FDWatcher& watcher, FdEvents, EventMode) mutable {
+        constexpr size_t max_iovecs = 64;
+        while (true)
         {
-            ssize_t size = ::write((int)fd, contents.begin(),
-                                   (size_t)contents.length());
-            if (size > 0)
+            while (not generated and pending.size() < max_iovecs)
             {
-                contents = contents.substr(ByteCount{(int)size});
+                StringView contents = generator();
                 if (contents.empty())
-                    contents = generator();
+                    generated = true;
+                else
+                    pending.push_back(contents);
             }
+
+            if (pending.empty())
+            {
+                watcher.disable();
+                fd.close();
+                return;
+            }
+
+            iovec iovecs[max_iovecs];
+            for (size_t i = 0; i < pending.size(); ++i)
+                iovecs[i] = {const_cast<char*>(pending[i].data()), (size_t)(int)pending[i].length()};
+
+            ssize_t size = ::writev((int)fd, iovecs, (int)pending.size());
             if (size == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
                 return;
-            if (size < 0 or contents.empty())
+            if (size < 0)
             {
-                fd.close();
                 watcher.disable();
+                fd.close();
                 return;
             }
+
+            auto it = pending.begin();
+            for (; it != pending.end() and size >= (int)it->length(); ++it)
+                size -= (int)it->length();
+            if (size > 0)
+                *it = it->substr(ByteCount{(int)size});
+            pending.erase(pending.begin(), it);
         }
     }};
 }
@@ -266,6 +269,286 @@ struct CommandFifos
 
 }
 
+void ShellManager::add_env_vars(StringView str, Vector<EnvVarRef>& vars)
+{
+    static const Regex re(R"(\bkak_(quoted_)?(\w+)\b)");
+
+    for (auto&& match : RegexIterator{str.begin(), str.end(), re})
+    {
+        EnvVarRef var{{match[2].first, match[2].second}, match[1].matched};
+        if (not contains(vars, var))
+            vars.push_back(std::move(var));
+    }
+}
+
+// Scripts are often evaluated many times, so the variables they reference
+// are extracted once and cached by script text. Parameters are arbitrary
+// data and are scanned on each evaluation instead.
+Vector<ShellManager::EnvVarRef> ShellManager::script_env_vars(StringView cmdline)
+{
+    if (auto it = m_script_env_vars.find(cmdline); it != m_script_env_vars.end())
+        return it->value;
+
+    Vector<EnvVarRef> vars;
+    add_env_vars(cmdline, vars);
+
+    constexpr size_t max_cached_scripts = 512;
+    if (m_script_env_vars.size() >= max_cached_scripts)
+        m_script_env_vars.clear();
+    m_script_env_vars.insert({cmdline.str(), vars});
+    return vars;
+}
+
+template<typename GetValue>
+Vector<String> ShellManager::generate_env(StringView cmdline, ConstArrayView<String> params, GetValue&& get_value)
+{
+    auto vars = script_env_vars(cmdline);
+    for (auto&& param : params)
+        add_env_vars(param, vars);
+
+    Vector<String> env;
+    for (auto& [name, quoted] : vars)
+    {
+        try
+        {
+            env.push_back(format("kak_{}{}={}", quoted ? "quoted_" : "", name,
+                                 get_value(name, quoted ? Quoting::Shell : Quoting::Raw)));
+        } catch (runtime_error&) {}
+    }
+    return env;
+}
+
+// Long lived shell, used to run scripts in a subshell without having to spawn
+// a new shell process for each of them.
+//
+// A job is started by writing its name on the worker stdin, the worker then
+// sources <dir>/<job>.env in a subshell reading from <dir>/<job>.in and writing
+// to <dir>/<job>.out and <dir>/<job>.err. That file sets up the environment and
+// sources the script, <dir>/<job>.sh. The worker replies with the subshell pid,
+// and then its exit status.
+struct ShellWorker
+{
+    ShellWorker(const char* shell)
+    {
+        static constexpr StringView driver =
+            "cd \"$1\" || exit\n"
+            "exec 2>/dev/null\n"
+            "while read -r job; do\n"
+            "    ( . \"./$job.env\" ) <\"$job.in\" >\"$job.out\" 2>\"$job.err\" &\n"
+            "    echo \"$!\"\n"
+            "    wait \"$!\"\n"
+            "    echo \"$?\"\n"
+            "done\n";
+
+        dir = format("{}/kak-shell.XXXXXX", tmpdir());
+        if (not mkdtemp(dir.data()))
+            throw runtime_error(format("unable to create shell worker directory: {}", strerror(errno)));
+        shell_process = spawn_shell(shell, driver, dir, {}, true);
+        shell_process.err.close();
+    }
+
+    ~ShellWorker()
+    {
+        shell_process.in.close();
+        shell_process.pid.close();
+        rmdir(dir.c_str());
+    }
+
+    String job_path(size_t job, StringView ext) const { return format("{}/{}.{}", dir, job, ext); }
+
+    String dir;
+    Shell shell_process;
+    String replies;      // data read from the worker, not yet consumed
+    size_t job_count = 0;
+    bool busy = false;
+    bool dead = false;
+};
+
+namespace
+{
+
+// Handle urgent events until done() returns true, displaying a message in the
+// status line if that takes too long. On cancel, interrupt() is called and the
+// wait goes on, true is returned once done.
+template<typename Done, typename Interrupt>
+bool wait_for_shell(const Context& context, sigset_t* sigmask, const bool& terminated,
+                    Done&& done, Interrupt&& interrupt)
+{
+    bool failed = false;
+
+    using namespace std::chrono;
+    static constexpr seconds wait_timeout{1};
+    const auto wait_time = Clock::now();
+    Optional<DisplayLine> previous_status;
+    Timer wait_timer{wait_time + wait_timeout, [&](Timer& timer) {
+        if (not context.has_client())
+            return;
+
+        const auto now = Clock::now();
+        timer.set_next_date(now + wait_timeout);
+        auto& client = context.client();
+        if (not previous_status)
+            previous_status = client.current_status();
+
+        client.print_status({format("waiting for shell command to finish{} ({}s)",
+                                     terminated ? " (shell terminated)" : "",
+                                     duration_cast<seconds>(now - wait_time).count()),
+                             context.faces()[failed ? "Error" : "Information"]});
+        client.redraw_ifn();
+    }, EventMode::Urgent};
+
+    bool cancelling = false;
+    while (not done())
+    {
+        try
+        {
+            EventManager::instance().handle_next_events(EventMode::Urgent, sigmask);
+        }
+        catch (cancel&)
+        {
+            interrupt();
+            cancelling = true;
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("error while waiting for shell: {}", error.what()));
+            failed = true;
+        }
+    }
+
+    if (not cancelling and previous_status) // restore the status line
+    {
+        context.print_status(std::move(*previous_status));
+        context.client().redraw_ifn();
+    }
+    return cancelling;
+}
+
+}
+
+ShellManager::~ShellManager() = default;
+
+void ShellManager::cancel_async_jobs()
+{
+    m_async_jobs.clear();
+}
+
+void ShellManager::stop_workers()
+{
+    for (auto& worker : m_workers)
+        worker->dead = true;
+    m_workers.erase(remove_if(m_workers, [](auto& worker) { return not worker->busy; }),
+                    m_workers.end());
+}
+
+ShellWorker* ShellManager::acquire_worker(int max_workers)
+{
+    m_workers.erase(remove_if(m_workers, [](auto& worker) { return worker->dead and not worker->busy; }),
+                    m_workers.end());
+    for (auto& worker : m_workers)
+    {
+        if (not worker->busy)
+            return worker.get();
+    }
+    if (m_workers.size() >= (size_t)max_workers)
+        return nullptr;
+
+    try
+    {
+        return m_workers.emplace_back(std::make_unique<ShellWorker>(m_shell.c_str())).get();
+    }
+    catch (runtime_error& error)
+    {
+        write_to_debug_buffer(format("unable to start shell worker: {}", error.what()));
+        return nullptr;
+    }
+}
+
+std::pair<String, int> ShellManager::eval_in_worker(
+    ShellWorker& worker, StringView cmdline, const Context& context,
+    FunctionRef<StringView ()> input_generator, ConstArrayView<String> params,
+    ConstArrayView<String> kak_env)
+{
+    const size_t job = worker.job_count++;
+    auto cleanup = on_scope_end([&] {
+        worker.busy = false;
+        for (auto ext : {"env", "sh", "in", "out", "err"})
+            unlink(worker.job_path(job, ext).c_str());
+    });
+    worker.busy = true;
+
+    char cwd[PATH_MAX];
+    if (not getcwd(cwd, sizeof(cwd)))
+        throw runtime_error(format("unable to get the current working directory: {}", strerror(errno)));
+    String env = format("unset -v job\ncd -- {} 2>/dev/null\n", shell_quote(cwd));
+    for (auto& var : kak_env)
+    {
+        auto eq = find(var, '=');
+        env += format("export {}={}\n", StringView{var.begin(), eq}, shell_quote({eq+1, var.end()}));
+    }
+    env += format("set -- {}\n", join(params | transform(shell_quote), ' ', false));
+    env += format(". {}\n", shell_quote(worker.job_path(job, "sh")));
+    write_to_file(worker.job_path(job, "env"), env);
+    write_to_file(worker.job_path(job, "sh"), cmdline);
+    {
+        const auto input_path = worker.job_path(job, "in");
+        const int fd = open(input_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+        if (fd == -1)
+            throw runtime_error(format("unable to open {}: {}", input_path, strerror(errno)));
+        auto close_fd = on_scope_end([fd]{ close(fd); });
+        for (auto input = input_generator(); not input.empty(); input = input_generator())
+            write(fd, input);
+    }
+
+    int job_pid = -1; // subshell running the job, reported first
+    int status = -1;
+    auto reader = make_reader((int)worker.shell_process.out, worker.replies, [&](bool) { worker.dead = true; });
+    auto parse_replies = [&] {
+        for (auto eol = find(worker.replies, '\n'); eol != worker.replies.end(); eol = find(worker.replies, '\n'))
+        {
+            const int value = str_to_int({worker.replies.begin(), eol});
+            if (job_pid == -1)
+                job_pid = value;
+            else
+                status = value;
+            worker.replies = String{eol+1, worker.replies.end()};
+        }
+        return status != -1 or worker.dead;
+    };
+
+    try
+    {
+        write((int)worker.shell_process.in, format("{}\n", job));
+    }
+    catch (runtime_error&)
+    {
+        worker.dead = true;
+    }
+
+    const bool terminated = false;
+    const bool cancelled = wait_for_shell(context, nullptr, terminated, parse_replies, [&] {
+        if (job_pid != -1)
+            kill(job_pid, SIGTERM); // asynchronous lists ignore SIGINT
+    });
+
+    String stdout_contents, stderr_contents;
+    if (status != -1)
+    {
+        stdout_contents = read_file(worker.job_path(job, "out"));
+        stderr_contents = read_file(worker.job_path(job, "err"));
+    }
+    if (not stderr_contents.empty())
+        write_to_debug_buffer(format("shell stderr: <<<\n{}>>>", stderr_contents));
+
+    if (worker.dead)
+        write_to_debug_buffer("shell worker died, it will be replaced");
+
+    if (cancelled)
+        throw cancel{};
+
+    return { std::move(stdout_contents), status };
+}
+
 std::pair<String, int> ShellManager::eval(
     StringView cmdline, const Context& context, FunctionRef<StringView ()> input_generator,
     Flags flags, const ShellContext& shell_context)
@@ -279,7 +562,7 @@ std::pair<String, int> ShellManager::eval(
 
     Optional<CommandFifos> command_fifos;
 
-    auto kak_env = generate_env(cmdline, shell_context.params, context, [&](StringView name, Quoting quoting) {
+    auto kak_env = generate_env(cmdline, shell_context.params, [&](StringView name, Quoting quoting) {
         if (name == "command_fifo" or name == "response_fifo")
         {
             if (not command_fifos)
@@ -293,7 +576,26 @@ std::pair<String, int> ShellManager::eval(
         return join(get_val(name, context) | transform(quoter(quoting)), ' ', false);
     });
 
+    using namespace std::chrono;
     auto spawn_time = profile ? Clock::now() : Clock::time_point{};
+
+    if (const int max_workers = context.options()["shell_workers"].get<int>(); max_workers > 0)
+    {
+        if (auto* worker = acquire_worker(max_workers))
+        {
+            auto res = eval_in_worker(*worker, cmdline, context, input_generator,
+                                      shell_context.params, kak_env);
+            if (profile)
+            {
+                auto full = duration_cast<microseconds>(Clock::now() - start_time);
+                auto env = duration_cast<microseconds>(spawn_time - start_time);
+                write_to_debug_buffer(format("shell execution took {} us (env: {}, worker)",
+                                             (size_t)full.count(), (size_t)env.count()));
+            }
+            return res;
+        }
+    }
+
     auto shell = spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env, true);
     auto wait_time = Clock::now();
 
@@ -313,49 +615,13 @@ std::pair<String, int> ShellManager::eval(
     int status = 0;
     // check for termination now that SIGCHLD is blocked
     bool terminated = waitpid((int)shell.pid, &status, WNOHANG) != 0;
-    bool failed = false;
 
-    using namespace std::chrono;
-    static constexpr seconds wait_timeout{1};
-    Optional<DisplayLine> previous_status;
-    Timer wait_timer{wait_time + wait_timeout, [&](Timer& timer) {
-        if (not context.has_client())
-            return;
-
-        const auto now = Clock::now();
-        timer.set_next_date(now + wait_timeout);
-        auto& client = context.client();
-        if (not previous_status)
-            previous_status = client.current_status();
-
-        client.print_status({format("waiting for shell command to finish{} ({}s)",
-                                     terminated ? " (shell terminated)" : "",
-                                     duration_cast<seconds>(now - wait_time).count()),
-                             context.faces()[failed ? "Error" : "Information"]});
-        client.redraw_ifn();
-    }, EventMode::Urgent};
-
-    bool cancelling = false;
-    while (not terminated or shell.in or
-           ((flags & Flags::WaitForStdout) and (shell.out or shell.err)))
-    {
-        try
-        {
-            EventManager::instance().handle_next_events(EventMode::Urgent, &orig_mask);
-        }
-        catch (cancel&)
-        {
-            kill((int)shell.pid, SIGINT);
-            cancelling = true;
-        }
-        catch (runtime_error& error)
-        {
-            write_to_debug_buffer(format("error while waiting for shell: {}", error.what()));
-            failed = true;
-        }
+    const bool cancelled = wait_for_shell(context, &orig_mask, terminated, [&] {
         if (not terminated)
             terminated = waitpid((int)shell.pid, &status, WNOHANG) == (int)shell.pid;
-    }
+        return terminated and not shell.in and
+               (not (flags & Flags::WaitForStdout) or (not shell.out and not shell.err));
+    }, [&] { kill((int)shell.pid, SIGINT); });
 
     if (not stderr_contents.empty())
         write_to_debug_buffer(format("shell stderr: <<<\n{}>>>", stderr_contents));
@@ -364,28 +630,172 @@ std::pair<String, int> ShellManager::eval(
     {
         auto end_time = Clock::now();
         auto full = duration_cast<microseconds>(end_time - start_time);
+        auto env = duration_cast<microseconds>(spawn_time - start_time);
         auto spawn = duration_cast<microseconds>(wait_time - spawn_time);
         auto wait = duration_cast<microseconds>(end_time - wait_time);
-        write_to_debug_buffer(format("shell execution took {} us (spawn: {}, wait: {})",
-                                     (size_t)full.count(), (size_t)spawn.count(), (size_t)wait.count()));
+        write_to_debug_buffer(format("shell execution took {} us (env: {}, spawn: {}, wait: {})",
+                                     (size_t)full.count(), (size_t)env.count(),
+                                     (size_t)spawn.count(), (size_t)wait.count()));
     }
 
-    if (cancelling)
+    if (cancelled)
         throw cancel{};
 
-    if (previous_status) // restore the status line
+    return { std::move(stdout_contents), WIFEXITED(status) ? WEXITSTATUS(status) : -1 };
+}
+
+struct ParallelShellJob
+{
+    struct Input
     {
-        context.print_status(std::move(*previous_status));
-        context.client().redraw_ifn();
+        StringView content;
+        StringView operator()() { return std::exchange(content, StringView{}); }
+    };
+
+    size_t index;
+    Shell shell;
+    Input input;
+    String stdout_contents, stderr_contents;
+    std::unique_ptr<FDWatcher> stdin_writer, stdout_reader, stderr_reader;
+    bool terminated = false;
+};
+
+Vector<String> ShellManager::eval_parallel(StringView cmdline, const Context& context,
+                                           ConstArrayView<String> inputs, int max_jobs,
+                                           FunctionRef<void (size_t index)> prepare)
+{
+    const DebugFlags debug_flags = context.options()["debug"].get<DebugFlags>();
+    const bool profile = debug_flags & DebugFlags::Profile;
+    if (debug_flags & DebugFlags::Shell)
+        write_to_debug_buffer(format("parallel shell:\n{}\n----\n", cmdline));
+
+    auto start_time = profile ? Clock::now() : Clock::time_point{};
+
+    // block SIGCHLD before spawning, so that we cannot miss it
+    sigset_t mask, orig_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &orig_mask);
+    auto restore_mask = on_scope_end([&] { sigprocmask(SIG_SETMASK, &orig_mask, nullptr); });
+
+    Vector<String> outputs;
+    outputs.resize(inputs.size());
+    Vector<std::unique_ptr<ParallelShellJob>> jobs;
+    size_t next_index = 0;
+    bool cancelled = false;
+
+    auto start_jobs = [&] {
+        while (not cancelled and next_index < inputs.size() and jobs.size() < (size_t)max_jobs)
+        {
+            prepare(next_index);
+            auto& job = *jobs.emplace_back(new ParallelShellJob{next_index, spawn(cmdline, context, true),
+                                                                {inputs[next_index]}, {}, {}, {}, {}, {}});
+            job.stdout_reader.reset(new FDWatcher(make_reader((int)job.shell.out, job.stdout_contents,
+                                                              [&job](bool) { job.shell.out.close(); })));
+            job.stderr_reader.reset(new FDWatcher(make_reader((int)job.shell.err, job.stderr_contents,
+                                                              [&job](bool) { job.shell.err.close(); })));
+            job.stdin_writer.reset(new FDWatcher(make_pipe_writer(job.shell.in, job.input)));
+            ++next_index;
+        }
+    };
+
+    const bool terminated = false;
+    start_jobs();
+    wait_for_shell(context, &orig_mask, terminated, [&] {
+        for (auto it = jobs.begin(); it != jobs.end(); )
+        {
+            auto& job = **it;
+            if (not job.terminated)
+                job.terminated = waitpid((int)job.shell.pid, nullptr, WNOHANG) == (int)job.shell.pid;
+            if (not job.terminated or job.shell.in or job.shell.out or job.shell.err)
+            {
+                ++it;
+                continue;
+            }
+
+            if (not job.stderr_contents.empty())
+                write_to_debug_buffer(format("shell stderr: <<<\n{}>>>", job.stderr_contents));
+            outputs[job.index] = std::move(job.stdout_contents);
+            job.shell.pid.descriptor = -1; // already waited for
+            it = jobs.erase(it);
+        }
+        start_jobs();
+        return jobs.empty();
+    }, [&] {
+        cancelled = true;
+        for (auto& job : jobs)
+            kill((int)job->shell.pid, SIGINT);
+    });
+
+    if (profile)
+    {
+        using namespace std::chrono;
+        auto full = duration_cast<microseconds>(Clock::now() - start_time);
+        write_to_debug_buffer(format("parallel shell execution of {} inputs took {} us",
+                                     inputs.size(), (size_t)full.count()));
     }
 
-    return { std::move(stdout_contents), WIFEXITED(status) ? WEXITSTATUS(status) : -1 };
+    if (cancelled)
+        throw cancel{};
+
+    return outputs;
+}
+
+struct AsyncShellJob
+{
+    Shell shell;
+    String stdout_contents, stderr_contents;
+    std::unique_ptr<FDWatcher> stdout_reader, stderr_reader;
+    Optional<Timer> exit_timer;
+    ShellManager::AsyncCallback on_complete;
+};
+
+void ShellManager::eval_async(StringView cmdline, const Context& context,
+                              const ShellContext& shell_context, AsyncCallback on_complete)
+{
+    if (context.options()["debug"].get<DebugFlags>() & DebugFlags::Shell)
+        write_to_debug_buffer(format("async shell:\n{}\n----\n", cmdline));
+
+    auto& job = *m_async_jobs.emplace_back(new AsyncShellJob{
+        spawn(cmdline, context, false, shell_context), {}, {}, {}, {}, {}, std::move(on_complete)});
+
+    // Completion is checked from a normal mode timer so that on_complete does
+    // not run while a synchronous shell evaluation is waiting for urgent events.
+    job.exit_timer.emplace(TimePoint::max(), [this, &job](Timer& timer) {
+        using namespace std::chrono;
+        int status = 0;
+        const int res = waitpid((int)job.shell.pid, &status, WNOHANG);
+        if (res == 0) // output closed but still running
+            return timer.set_next_date(Clock::now() + milliseconds{10});
+        job.shell.pid.descriptor = -1; // reaped, or not our child anymore
+
+        if (not job.stderr_contents.empty())
+            write_to_debug_buffer(format("shell stderr: <<<\n{}>>>", job.stderr_contents));
+
+        auto on_complete = std::move(job.on_complete);
+        auto output = std::move(job.stdout_contents);
+        auto it = find_if(m_async_jobs, [&](auto& j) { return j.get() == &job; });
+        kak_assert(it != m_async_jobs.end());
+        m_async_jobs.erase(it); // destroys this timer, only use locals from now on
+
+        on_complete(std::move(output), res == -1 or not WIFEXITED(status) ? -1 : WEXITSTATUS(status));
+    }, EventMode::Normal);
+
+    auto on_close = [&job](UniqueFd& fd) {
+        return [&job, &fd](bool) {
+            fd.close();
+            if (not job.shell.out and not job.shell.err)
+                job.exit_timer->set_next_date(Clock::now());
+        };
+    };
+    job.stdout_reader.reset(new FDWatcher(make_reader((int)job.shell.out, job.stdout_contents, on_close(job.shell.out))));
+    job.stderr_reader.reset(new FDWatcher(make_reader((int)job.shell.err, job.stderr_contents, on_close(job.shell.err))));
 }
 
 Shell ShellManager::spawn(StringView cmdline, const Context& context,
                           bool open_stdin, const ShellContext& shell_context)
 {
-    auto kak_env = generate_env(cmdline, shell_context.params, context, [&](StringView name, Quoting quoting) {
+    auto kak_env = generate_env(cmdline, shell_context.params, [&](StringView name, Quoting quoting) {
         if (auto it = shell_context.env_vars.find(name); it != shell_context.env_vars.end())
             return it->value;
         return join(get_val(name, context) | transform(quoter(quoting)), ' ', false);
@@ -403,7 +813,36 @@ Vector<String> ShellManager::get_val(StringView name, const Context& context) co
     if (env_var == m_env_vars.end())
         throw runtime_error("no such variable: " + name);
 
-    return env_var->func(name, context);
+    if (not m_env_var_snapshot)
+        return env_var->func(name, context);
+
+    // buffer contents can change while waiting for a shell, through fifo buffers
+    const size_t timestamp = context.has_buffer() ? context.buffer().timestamp() : 0;
+    auto& values = m_env_var_snapshot->m_values;
+    auto it = find_if(values, [&](const EnvVarSnapshot::Value& v) {
+        return v.name == name and v.context == &context and v.timestamp == timestamp;
+    });
+    if (it != values.end())
+        return it->value;
+
+    auto value = env_var->func(name, context);
+    values.push_back({name.str(), &context, timestamp, value});
+    return value;
+}
+
+ShellManager::EnvVarSnapshot::EnvVarSnapshot()
+    : m_previous{ShellManager::instance().m_env_var_snapshot}
+{
+    if (m_previous)
+        m_previous->m_values.clear();
+    ShellManager::instance().m_env_var_snapshot = this;
+}
+
+ShellManager::EnvVarSnapshot::~EnvVarSnapshot()
+{
+    if (m_previous)
+        m_previous->m_values.clear();
+    ShellManager::instance().m_env_var_snapshot = m_previous;
 }
 
 CandidateList ShellManager::complete_env_var(StringView prefix,
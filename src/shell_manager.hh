@@ -7,6 +7,10 @@
 #include "utils.hh"
 #include "unique_descriptor.hh"
 #include "completion.hh"
+#include "hash_map.hh"
+
+#include <functional>
+#include <memory>
 
 #include <signal.h>
 #include <sys/wait.h>
@@ -16,6 +20,8 @@ namespace Kakoune
 {
 
 class Context;
+struct ShellWorker;
+struct AsyncShellJob;
 
 struct ShellContext
 {
@@ -49,6 +55,7 @@ class ShellManager : public Singleton<ShellManager>
 {
 public:
     ShellManager(ConstArrayView<EnvVarDesc> builtin_env_vars);
+    ~ShellManager();
 
     enum class Flags
     {
@@ -72,6 +79,21 @@ public:
                     flags, shell_context);
     }
 
+    using AsyncCallback = std::function<void (String output, int status)>;
+
+    // Run cmdline in the background, on_complete is called from the main
+    // event loop once it has exited and closed its stdout and stderr.
+    void eval_async(StringView cmdline, const Context& context,
+                    const ShellContext& shell_context, AsyncCallback on_complete);
+
+    // Run cmdline once per input, feeding it on stdin, with at most max_jobs
+    // shells running at once. prepare(index) is called before spawning the
+    // shell for inputs[index], so that its environment reflects that input.
+    // Outputs are returned in input order.
+    Vector<String> eval_parallel(StringView cmdline, const Context& context,
+                                 ConstArrayView<String> inputs, int max_jobs,
+                                 FunctionRef<void (size_t index)> prepare);
+
     Shell spawn(StringView cmdline,
                 const Context& context,
                 bool open_stdin,
@@ -79,12 +101,66 @@ public:
 
     Vector<String> get_val(StringView name, const Context& context) const;
 
+    // While a snapshot is alive, get_val results are computed once and
+    // shared by all the expansions that request them. Opening or closing
+    // a snapshot drops the cached values of the enclosing one, as the
+    // commands run in between could have changed them.
+    class EnvVarSnapshot
+    {
+    public:
+        EnvVarSnapshot();
+        ~EnvVarSnapshot();
+
+        EnvVarSnapshot(const EnvVarSnapshot&) = delete;
+        EnvVarSnapshot& operator=(const EnvVarSnapshot&) = delete;
+
+    private:
+        friend class ShellManager;
+        struct Value
+        {
+            String name;
+            const Context* context;
+            size_t timestamp;
+            Vector<String> value;
+        };
+        Vector<Value> m_values;
+        EnvVarSnapshot* m_previous;
+    };
+
     CandidateList complete_env_var(StringView prefix, ByteCount cursor_pos) const;
 
+    // stop the shell workers once idle, new ones are started when needed
+    void stop_workers();
+    // drop the pending async evaluations without running their callbacks
+    void cancel_async_jobs();
+
 private:
+    struct EnvVarRef
+    {
+        String name;
+        bool quoted;
+
+        friend bool operator==(const EnvVarRef&, const EnvVarRef&) = default;
+    };
+    static void add_env_vars(StringView str, Vector<EnvVarRef>& vars);
+    Vector<EnvVarRef> script_env_vars(StringView cmdline);
+
+    template<typename GetValue>
+    Vector<String> generate_env(StringView cmdline, ConstArrayView<String> params, GetValue&& get_value);
+
+    ShellWorker* acquire_worker(int max_workers);
+    std::pair<String, int> eval_in_worker(ShellWorker& worker, StringView cmdline, const Context& context,
+                                          FunctionRef<StringView ()> input_generator,
+                                          ConstArrayView<String> params, ConstArrayView<String> kak_env);
+
     String m_shell;
+    Vector<std::unique_ptr<ShellWorker>> m_workers;
+    Vector<std::unique_ptr<AsyncShellJob>> m_async_jobs;
 
     ConstArrayView<EnvVarDesc> m_env_vars;
+
+    HashMap<String, Vector<EnvVarRef>, MemoryDomain::EnvVars> m_script_env_vars;
+    EnvVarSnapshot* m_env_var_snapshot = nullptr;
 };
 
 }
@@ -5,6 +5,7 @@
 #include "buffer_utils.hh"
 #include "context.hh"
 #include "highlighter.hh"
+#include "highlighter_cache.hh"
 #include "hook_manager.hh"
 #include "input_handler.hh"
 #include "client.hh"
@@ -22,9 +23,9 @@ namespace Kakoune
 void setup_builtin_highlighters(HighlighterGroup& group);
 
 Window::Window(Buffer& buffer)
-    : Scope(buffer),
+    : Scope(buffer, "window"),
       m_buffer(&buffer),
-      m_builtin_highlighters{highlighters()}
+      m_builtin_highlighters{highlighters(), "builtin"}
 {
     run_hook_in_own_context(Hook::WinCreate, buffer.name());
 
@@ -76,14 +77,6 @@ void Window::center_column(ColumnCount buffer_column)
     display_column_at(buffer_column, m_dimensions.column/2_col);
 }
 
-static uint32_t compute_faces_hash(const FaceRegistry& faces)
-{
-    uint32_t hash = 0;
-    for (auto&& face : faces.flatten_faces() | transform(&FaceRegistry::FaceMap::Item::value))
-        hash = combine_hash(hash, face.base.empty() ? hash_value(face.face) : hash_value(face.base));
-    return hash;
-}
-
 Window::Setup Window::build_setup(const Context& context) const
 {
     return {m_position, m_dimensions,
@@ -112,6 +105,7 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
         write_to_debug_buffer(format("window display update for '{}' took {} us",
                                      buffer().display_name(), (size_t)duration.count()));
     }, not (buffer().flags() & Buffer::Flags::Debug)};
+    auto profiled_frame = HighlighterProfiler::instance().frame(profile.active());
 
     if (m_display_buffer.timestamp() != -1)
     {
@@ -145,10 +139,18 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
     m_display_buffer.compute_range();
     const BufferRange range{{0,0}, buffer().end_coord()};
     m_builtin_highlighters.highlight({context, setup, HighlightPass::Wrap, {}}, m_display_buffer, range);
+
+    const auto clipped_lines = clip_long_lines(context, setup);
     m_builtin_highlighters.highlight({context, setup, HighlightPass::Move, {}}, m_display_buffer, range);
 
-    for (auto& line : m_display_buffer.lines())
-        line.trim_from(setup.widget_columns, setup.first_column, m_dimensions.column);
+    for (auto& line : lines)
+    {
+        const LineCount buf_line = line.range().begin.line;
+        auto it = std::lower_bound(clipped_lines.begin(), clipped_lines.end(), buf_line,
+                                   [](const ClippedLine& clipped, LineCount l) { return clipped.line < l; });
+        const bool clipped = it != clipped_lines.end() and it->line == buf_line;
+        line.trim_from(setup.widget_columns, clipped ? it->first_column : setup.first_column, m_dimensions.column);
+    }
     if (m_display_buffer.lines().size() > m_dimensions.line)
         m_display_buffer.lines().resize((size_t)m_dimensions.line);
 
@@ -156,6 +158,9 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
 
     m_display_buffer.optimize();
 
+    HighlighterCacheManager::instance().enforce_budget(
+        (size_t)context.options()["highlight_cache_size"].get<int>() * 1024);
+
     set_position({setup.first_line, setup.first_column});
     m_last_setup = build_setup(context);
     m_last_display_setup = setup;
@@ -163,6 +168,39 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
     return m_display_buffer;
 }
 
+Vector<Window::ClippedLine, MemoryDomain::Display> Window::clip_long_lines(const Context& context, const DisplaySetup& setup)
+{
+    const ByteCount long_line_length = context.options()["long_line_length"].get<int>();
+    if (long_line_length <= 0)
+        return {};
+
+    // columns displayed on each side of the visible ones, giving highlighters
+    // some context around the visible part of clipped lines
+    constexpr ColumnCount margin = 1024;
+
+    const int tabstop = context.options()["tabstop"].get<int>();
+    DisplayLineList& lines = m_display_buffer.lines();
+    Vector<ClippedLine, MemoryDomain::Display> clipped_lines;
+    for (auto& line : lines)
+    {
+        const LineCount buf_line = line.range().begin.line;
+        const ByteCount length = buffer()[buf_line].length();
+        if (length <= long_line_length or line.atoms().size() != 1 or
+            line.range() != BufferRange{{buf_line, 0}, {buf_line, length}}) // wrapped or already modified
+            continue;
+
+        const ByteCount begin = get_byte_to_column(buffer(), tabstop, {buf_line, std::max(0_col, setup.first_column - margin)});
+        const ByteCount end = get_byte_to_column(buffer(), tabstop, {buf_line, setup.first_column + m_dimensions.column + margin});
+        line = DisplayLine{AtomList{{buffer(), {{buf_line, begin}, {buf_line, std::max(begin, end)}}}}};
+
+        clipped_lines.push_back({buf_line, setup.first_column - get_column(buffer(), tabstop, {buf_line, begin})});
+    }
+
+    if (not clipped_lines.empty())
+        m_display_buffer.compute_range();
+    return clipped_lines;
+}
+
 void Window::set_position(DisplayCoord position)
 {
     m_position.line = clamp(position.line, 0_line, buffer().line_count()-1);
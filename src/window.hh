@@ -55,6 +55,11 @@ private:
     Window(const Window&) = delete;
 
     DisplaySetup compute_display_setup(const Context& context) const;
+    // restrict display lines longer than the long_line_length option to their
+    // visible columns, returns the first column to display of the clipped lines,
+    // by buffer line, as later highlighters can add or remove display lines
+    struct ClippedLine { LineCount line; ColumnCount first_column; };
+    Vector<ClippedLine, MemoryDomain::Display> clip_long_lines(const Context& context, const DisplaySetup& setup);
     void on_option_changed(const Option& option) override;
 
     friend class ClientManager;